@@ -0,0 +1,318 @@
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+
+#include "camera.h"
+#include "model.h"
+#include "renderer.h"
+
+using namespace glm;
+
+// Renders a fixed set of scenes at a fixed resolution and sample count, timing every sample with
+// GL_TIME_ELAPSED queries so vsync and window overhead stay out of the numbers, and writes the
+// results as JSON:
+//     raytracer_bench [output.json] [--width W] [--height H] [--spp N] [--warmup N] [--scene name]...
+//                     [--triangle-format vertices|edges|watertight]...
+// Every scene runs once per triangle format given, by default only in the vertex format.
+
+struct BenchmarkScene {
+    std::string name;
+    vec3 cameraPosition;
+    std::function<void(std::vector<Sphere> &spheres)> build;
+    // optional, called before every timed sample to deform a mesh, returns its id
+    std::function<uint(uint frame)> animate = nullptr;
+};
+
+const char* triangleFormatNames[] = {"vertices", "edges", "watertight"};
+
+struct BenchmarkResult {
+    std::string name;
+    TriangleFormat triangleFormat;
+    size_t bytesPerTriangle;
+    size_t triangleCount;
+    size_t modelCount;
+    size_t sphereCount;
+    double loadSeconds;
+    double totalMs;
+    double msPerSample;
+    double minMsPerSample;
+    double maxMsPerSample;
+    double mpixelSamplesPerSecond;
+    double animateMsPerFrame;
+    size_t gpuMemoryBytes;
+    size_t sceneMemoryBytes;
+};
+
+mat3 identityRotation = mat3(1);
+
+void buildBox() {
+    Transform transform = {vec3(0.0), identityRotation, vec3(1.0)};
+    new Model(loadMesh(RESOURCES_PATH "box.obj", 0, 12), {vec3(0.0, 1.0, 0.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0}, transform);
+    new Model(loadMesh(RESOURCES_PATH "box.obj", 12, 12), {vec3(1.0, 0.0, 0.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0}, transform);
+    new Model(loadMesh(RESOURCES_PATH "box.obj", 24, 38), {vec3(1.0, 1.0, 1.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0}, transform);
+    new Model(loadMesh(RESOURCES_PATH "box.obj", 62, 12), {vec3(1.0, 1.0, 1.0), 1.0, vec3(1.0), 5.0, 1.0, 0.0, 1.0, 0.0}, transform);
+}
+
+float gridHeight(float x, float z, float time) {
+    return 0.1f * sin(x * 7.0f + time) * cos(z * 5.0f);
+}
+
+// a wavy height field with 2 * resolution^2 triangles, returns its mesh
+uint buildGrid(uint resolution, float size, Material material) {
+    uint firstTriangle = triangles.size();
+    auto vertex = [&](uint i, uint j) {
+        float x = (i / (float)resolution - 0.5f) * size;
+        float z = (j / (float)resolution - 0.5f) * size;
+        return vec3(x, gridHeight(x, z, 0.0f), z);
+    };
+    triangles.reserve(triangles.size() + 2 * (size_t)resolution * resolution);
+    for (uint i = 0; i < resolution; i++) {
+        for (uint j = 0; j < resolution; j++) {
+            vec3 a = vertex(i, j), b = vertex(i + 1, j), c = vertex(i + 1, j + 1), d = vertex(i, j + 1);
+            vec3 n0 = normalize(cross(c - a, b - a));
+            vec3 n1 = normalize(cross(d - a, c - a));
+            triangles.push_back({vec4(a, 0.0), vec4(c, 0.0), vec4(b, 0.0), vec4(n0, 0.0), vec4(n0, 0.0), vec4(n0, 0.0)});
+            triangles.push_back({vec4(a, 0.0), vec4(d, 0.0), vec4(c, 0.0), vec4(n1, 0.0), vec4(n1, 0.0), vec4(n1, 0.0)});
+        }
+    }
+    Model* model = new Model(firstTriangle, triangles.size() - firstTriangle, material, {vec3(0.0, -1.0, 0.0), identityRotation, vec3(1.0)});
+    return model->meshId;
+}
+
+// lets the waves of a buildGrid mesh travel, the BVH is refit rather than rebuilt
+void animateGrid(uint meshId, float time) {
+    const Mesh &mesh = meshes[meshId];
+    for (uint i = mesh.triangleIndex; i < mesh.triangleIndex + mesh.triangleCount; i++) {
+        Triangle &triangle = triangles[i];
+        triangle.pos_uvx_A.y = gridHeight(triangle.pos_uvx_A.x, triangle.pos_uvx_A.z, time);
+        triangle.pos_uvx_B.y = gridHeight(triangle.pos_uvx_B.x, triangle.pos_uvx_B.z, time);
+        triangle.pos_uvx_C.y = gridHeight(triangle.pos_uvx_C.x, triangle.pos_uvx_C.z, time);
+        vec3 normal = normalize(cross(vec3(triangle.pos_uvx_B - triangle.pos_uvx_A), vec3(triangle.pos_uvx_C - triangle.pos_uvx_A)));
+        triangle.normal_uvy_A = triangle.normal_uvy_B = triangle.normal_uvy_C = vec4(normal, 0.0);
+    }
+    updateMesh(meshId);
+}
+
+uint animatedGrid = 0;
+
+std::vector<BenchmarkScene> benchmarkScenes = {
+    {"box", vec3(0, 0, 4), [](std::vector<Sphere> &) {
+        buildBox();
+    }},
+    {"model", vec3(0, 0, 4), [](std::vector<Sphere> &) {
+        buildBox();
+        new Model(RESOURCES_PATH "model.obj", {vec3(1.0), 0.01, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 1.0}, {vec3(0.0), identityRotation, vec3(1.0)});
+    }},
+    {"million_triangles", vec3(0, 1, 4), [](std::vector<Sphere> &) {
+        buildGrid(708, 6.0f, {vec3(0.8), 0.5, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0});
+    }},
+    {"animated_grid", vec3(0, 1, 4), [](std::vector<Sphere> &) {
+        animatedGrid = buildGrid(256, 6.0f, {vec3(0.8), 0.5, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0});
+    }, [](uint frame) {
+        animateGrid(animatedGrid, frame * 0.1f);
+        return animatedGrid;
+    }},
+    {"thousand_instances", vec3(0, 0, 60), [](std::vector<Sphere> &) {
+        uint mesh = loadMesh(RESOURCES_PATH "model.obj");
+        for (int i = 0; i < 40; i++) {
+            for (int j = 0; j < 25; j++) {
+                vec3 translation = vec3((i - 19.5f) * 3.0f, (j - 12.0f) * 2.5f, -10.0f);
+                new Model(mesh, {vec3(0.9, 0.6, 0.3), 0.3, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0}, {translation, identityRotation, vec3(1.0)});
+            }
+        }
+    }},
+};
+
+BenchmarkResult runScene(Renderer &renderer, const BenchmarkScene &scene, uint spp, uint warmup) {
+    BenchmarkResult result = {};
+    result.name = scene.name;
+    result.triangleFormat = renderer.triangleFormat;
+
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    clearMeshes();
+    models.clear();
+    std::vector<Sphere> spheres;
+    scene.build(spheres);
+    std::vector<SSBO_Model> SSBO_models;
+    std::vector<Model> instances;
+    for (Model* model : models) {
+        SSBO_models.push_back(model->get_SSBO_Model());
+        instances.push_back(*model);
+        delete model;
+    }
+    models.clear();
+    renderer.sendSpheres(spheres);
+    renderer.sendTriangles(triangles);
+    renderer.sendBVHNodes(bvhNodes);
+    renderer.sendModels(SSBO_models);
+    glFinish();
+    result.loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+
+    result.triangleCount = triangles.size();
+    result.modelCount = SSBO_models.size();
+    result.sphereCount = spheres.size();
+    result.gpuMemoryBytes = renderer.gpuMemoryBytes();
+    result.bytesPerTriangle = renderer.bytesPerTriangle();
+    result.sceneMemoryBytes = triangles.size() * sizeof(Triangle) + bvhNodes.size() * sizeof(BVHNode) + SSBO_models.size() * sizeof(SSBO_Model) + spheres.size() * sizeof(Sphere);
+
+    Camera camera = {scene.cameraPosition, vec3(0, 0, -1), vec3(0, 1, 0), vec3(-1, 0, 0), uvec2(renderer.width, renderer.height), (float)(tan(45.0 / 180.0 * 3.1415926)*.5 * (float)renderer.height)};
+
+    for (uint i = 0; i < warmup; i++)
+        renderer.raytrace(camera, i);
+    glFinish();
+
+    std::vector<GLuint> queries(spp);
+    glGenQueries(spp, queries.data());
+    for (uint i = 0; i < spp; i++) {
+        if (scene.animate) {
+            auto animateStart = std::chrono::high_resolution_clock::now();
+            uint nodeCount = bvhNodes.size();
+            const Mesh &mesh = meshes[scene.animate(i)];
+            // triangles stay in their range; a rebuild that resized the tree shifted every node behind it
+            renderer.updateTriangles(triangles, mesh.triangleIndex, mesh.triangleCount);
+            if (bvhNodes.size() == nodeCount) renderer.updateBVHNodes(bvhNodes, mesh.nodeIndex, mesh.nodeCount);
+            else renderer.appendBVHNodes(bvhNodes, mesh.nodeIndex);
+            // the moved mesh's bounds changed, and a rebuilt BVH shifts the nodes of the meshes behind
+            // it; only the models whose record differs are rewritten
+            for (size_t m = 0; m < instances.size(); m++) {
+                SSBO_Model record = instances[m].get_SSBO_Model();
+                if (std::memcmp(&record, &SSBO_models[m], sizeof(SSBO_Model)) == 0) continue;
+                SSBO_models[m] = record;
+                renderer.updateModel(m, record);
+            }
+            result.animateMsPerFrame += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - animateStart).count() / spp;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        renderer.raytrace(camera, i);
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    glFinish();
+
+    result.minMsPerSample = 1e30;
+    for (uint i = 0; i < spp; i++) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+        double ms = nanoseconds / 1e6;
+        result.totalMs += ms;
+        result.minMsPerSample = min(result.minMsPerSample, ms);
+        result.maxMsPerSample = max(result.maxMsPerSample, ms);
+    }
+    glDeleteQueries(spp, queries.data());
+
+    result.msPerSample = result.totalMs / spp;
+    // every frame traces samplesPerPixel paths per pixel, bounces and shadow rays are not counted
+    double pixelSamples = (double)renderer.width * renderer.height * renderer.samplesPerPixel * spp;
+    result.mpixelSamplesPerSecond = pixelSamples / (result.totalMs / 1000.0) / 1e6;
+    return result;
+}
+
+void writeJson(const std::string &path, const std::vector<BenchmarkResult> &results, uint width, uint height, uint spp) {
+    std::ofstream file(path);
+    file << "{\n";
+    file << "  \"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\",\n";
+    file << "  \"version\": \"" << (const char*)glGetString(GL_VERSION) << "\",\n";
+    file << "  \"width\": " << width << ",\n";
+    file << "  \"height\": " << height << ",\n";
+    file << "  \"spp\": " << spp << ",\n";
+    file << "  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &result = results[i];
+        file << "    {\n";
+        file << "      \"name\": \"" << result.name << "\",\n";
+        file << "      \"triangle_format\": \"" << triangleFormatNames[result.triangleFormat] << "\",\n";
+        file << "      \"bytes_per_triangle\": " << result.bytesPerTriangle << ",\n";
+        file << "      \"triangles\": " << result.triangleCount << ",\n";
+        file << "      \"models\": " << result.modelCount << ",\n";
+        file << "      \"spheres\": " << result.sphereCount << ",\n";
+        file << "      \"load_seconds\": " << result.loadSeconds << ",\n";
+        file << "      \"total_ms\": " << result.totalMs << ",\n";
+        file << "      \"ms_per_sample\": " << result.msPerSample << ",\n";
+        file << "      \"min_ms_per_sample\": " << result.minMsPerSample << ",\n";
+        file << "      \"max_ms_per_sample\": " << result.maxMsPerSample << ",\n";
+        file << "      \"mpixel_samples_per_second\": " << result.mpixelSamplesPerSecond << ",\n";
+        file << "      \"animate_ms_per_frame\": " << result.animateMsPerFrame << ",\n";
+        file << "      \"gpu_memory_bytes\": " << result.gpuMemoryBytes << ",\n";
+        file << "      \"scene_memory_bytes\": " << result.sceneMemoryBytes << "\n";
+        file << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string outputPath = "benchmark.json";
+    uint width = 1920 / 4, height = 1080 / 4, spp = 64, warmup = 4;
+    std::vector<std::string> sceneFilter;
+    std::vector<TriangleFormat> triangleFormats;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--width" && i + 1 < argc) width = std::stoi(argv[++i]);
+        else if (arg == "--height" && i + 1 < argc) height = std::stoi(argv[++i]);
+        else if (arg == "--spp" && i + 1 < argc) spp = std::stoi(argv[++i]);
+        else if (arg == "--warmup" && i + 1 < argc) warmup = std::stoi(argv[++i]);
+        else if (arg == "--scene" && i + 1 < argc) sceneFilter.push_back(argv[++i]);
+        else if (arg == "--triangle-format" && i + 1 < argc) {
+            std::string name = argv[++i];
+            auto format = std::find(std::begin(triangleFormatNames), std::end(triangleFormatNames), name);
+            if (format == std::end(triangleFormatNames)) {
+                std::cout << "Unknown triangle format: " << name << std::endl;
+                return -1;
+            }
+            triangleFormats.push_back((TriangleFormat)(format - std::begin(triangleFormatNames)));
+        }
+        else outputPath = arg;
+    }
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    GLFWwindow* window = glfwCreateWindow(width, height, "raytracer benchmark", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return -1;
+    }
+
+    if (triangleFormats.empty()) triangleFormats.push_back(TRIANGLE_VERTICES);
+
+    std::vector<BenchmarkResult> results;
+    {
+        Renderer renderer(width, height);
+        for (const BenchmarkScene &scene : benchmarkScenes) {
+            if (!sceneFilter.empty() && std::find(sceneFilter.begin(), sceneFilter.end(), scene.name) == sceneFilter.end()) continue;
+            for (TriangleFormat triangleFormat : triangleFormats) {
+                renderer.triangleFormat = triangleFormat;
+                BenchmarkResult result = runScene(renderer, scene, spp, warmup);
+                std::cout << result.name << " (" << triangleFormatNames[triangleFormat] << "): " << result.msPerSample << " ms/sample, " << result.mpixelSamplesPerSecond << " Mpixel samples/s, "
+                          << result.bytesPerTriangle << " B/triangle, " << result.gpuMemoryBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+                results.push_back(result);
+            }
+        }
+        writeJson(outputPath, results, width, height, spp);
+    }
+
+    glfwTerminate();
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "batch.h"
+#include "imageEncoder.h"
+
+using namespace glm;
+
+// Combines the sample batches of a distributed render (see --batch-samples) into one image:
+//     raytracer_merge <output.png|qoi|pfm|rtsb> <batch.rtsb>...
+// Radiance sums and sample counts are added and divided once at the end, so the result does not
+// depend on the order or grouping of the batches. Writing .rtsb gives a batch that can be merged
+// again, e.g. per rack first.
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cout << "usage: raytracer_merge <output.png|qoi|pfm|rtsb> <batch.rtsb>..." << std::endl;
+        return -1;
+    }
+    std::string outputPath = argv[1];
+
+    BatchInfo merged = {0, 0, 0};
+    uint width = 0, height = 0;
+    std::vector<float> sums;
+    std::vector<std::pair<uint, uint>> ranges;
+    for (int i = 2; i < argc; i++) {
+        BatchInfo info;
+        uint batchWidth, batchHeight;
+        std::vector<float> batchSums;
+        if (!readBatch(argv[i], info, batchWidth, batchHeight, batchSums)) return -1;
+        if (i == 2) {
+            merged = info;
+            width = batchWidth;
+            height = batchHeight;
+            sums.assign(batchSums.size(), 0.0f);
+        } else if (info.sceneHash != merged.sceneHash || batchWidth != width || batchHeight != height) {
+            std::cout << "ERROR::MERGE::SCENE_MISMATCH: " << argv[i] << " was rendered from a different scene or resolution" << std::endl;
+            return -1;
+        }
+        for (std::pair<uint, uint> range : ranges)
+            if (info.firstFrame < range.second && range.first < info.firstFrame + info.frameCount)
+                std::cout << "WARNING::MERGE::OVERLAPPING_FRAMES: " << argv[i] << " repeats samples of another batch" << std::endl;
+        ranges.push_back({info.firstFrame, info.firstFrame + info.frameCount});
+        for (size_t j = 0; j < sums.size(); j++)
+            sums[j] += batchSums[j];
+    }
+
+    // the merged range is only meaningful when the batches are contiguous
+    std::sort(ranges.begin(), ranges.end());
+    merged.firstFrame = ranges.front().first;
+    merged.frameCount = 0;
+    for (std::pair<uint, uint> range : ranges)
+        merged.frameCount += range.second - range.first;
+
+    if (outputPath.size() >= 5 && outputPath.compare(outputPath.size() - 5, 5, ".rtsb") == 0) {
+        if (!writeBatch(outputPath, merged, width, height, sums)) {
+            std::cout << "ERROR::MERGE::WRITE_FAILED: " << outputPath << std::endl;
+            return -1;
+        }
+    } else {
+        EncodeJob job;
+        job.path = outputPath;
+        job.width = width;
+        job.height = height;
+        job.pixels = sums;
+        for (size_t j = 0; j < job.pixels.size(); j += 4)
+            for (int c = 0; c < 3; c++)
+                job.pixels[j + c] = sums[j + 3] > 0.0f ? sums[j + c] / sums[j + 3] : 0.0f;
+        ImageEncoder encoder(1);
+        encoder.submit(std::move(job));
+        encoder.wait();
+    }
+    std::cout << "Merged " << argc - 2 << " batches, " << merged.frameCount << " frames" << std::endl;
+    return 0;
+}
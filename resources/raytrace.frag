@@ -1,10 +1,54 @@
 #version 460 core
 
-uniform uvec2 uResolution;
-uniform vec3 cameraPosition;
+// Renderer compiles a variant per scene feature set (see Renderer::shaderDefines) so the loops and
+// branches a scene can't reach are compiled out; without the defines everything is compiled in.
+// Disabled branches still draw their random numbers, every variant renders the same image.
+#ifndef SCENE_HAS_SPHERES
+#define SCENE_HAS_SPHERES 1
+#endif
+#ifndef SCENE_HAS_MODELS
+#define SCENE_HAS_MODELS 1
+#endif
+#ifndef SCENE_HAS_METAL
+#define SCENE_HAS_METAL 1
+#endif
+#ifndef SCENE_HAS_TRANSMISSION
+#define SCENE_HAS_TRANSMISSION 1
+#endif
+// 0 = from the vertices, 1 = precomputed edges, 2 = watertight, see TriangleFormat in renderer.h
+#ifndef TRIANGLE_FORMAT
+#define TRIANGLE_FORMAT 0
+#endif
+
+// everything that changes per frame, written by Renderer::raytrace in one go (FrameConstants in renderer.h)
+layout (std140, binding = 0) uniform FrameConstants {
+    vec3 cameraPosition;
+    float uFocalLength;
+    vec3 cameraForward;
+    // the sphere and model buffers are bound with spare room, only the first sphereCount/modelCount entries are valid
+    uint sphereCount;
+    vec3 cameraUp;
+    uint modelCount;
+    vec3 cameraRight;
+    uint renderedFrames;
+    uvec2 uResolution;
+    // the accumulation textures may cover only a tile of the uResolution image, starting at this pixel
+    uvec2 uTileOffset;
+    int uMaxBounces_reflection;
+    int uMaxBounces_transmission;
+    int samplesPerPixel;
+    uint frameOffset;
+    // hybrid rendering, see uCpuSamples
+    uint cpuRowStart;
+    uint cpuBatchRowStart;
+    bool cpuSamplesReady;
+    // debug view: 0 = off, 1 = node visits, 2 = triangle tests, 3 = bounces per pixel as a heatmap,
+    // 4 = ambient occlusion within debugHeatmapMax
+    int debugMode;
+    float debugHeatmapMax;
+};
 
 in vec2 uv;
-in vec3 rayDir;
 
 out vec4 FragColor;
 
@@ -53,12 +97,20 @@ struct Material {
 };
 
 
-struct Sphere {
-    vec4 pos_radius;
-    vec4 color_smoothness;
+// shared by every sphere and model using it, see GPUMaterial in renderer.h
+struct MaterialRecord {
+    vec4 color_roughness;
     vec4 emissionColor_emissionStrength;
     vec4 transmission_ior_metalness_tbd;
 };
+layout (std430, binding = 5) buffer MaterialBuffer {
+    MaterialRecord materials[];
+};
+
+struct Sphere {
+    vec4 pos_radius;
+    uint materialIndex;
+};
 layout (std430, binding = 0) buffer SphereBuffer {
     Sphere spheres[];
 };
@@ -75,26 +127,56 @@ layout (std430, binding = 1) buffer TriangleBuffer {
     Triangle triangles[];
 };
 
+#if TRIANGLE_FORMAT == 1
+// vertex A and both edges of triangles[i], the w components hold the unnormalized geometric normal
+struct TriangleEdges {
+    vec4 posA_normalX;
+    vec4 edgeAB_normalY;
+    vec4 edgeAC_normalZ;
+};
+layout (std430, binding = 6) buffer TriangleEdgeBuffer {
+    TriangleEdges triangleEdges[];
+};
+#endif
+
+struct BVHNode {
+    vec3 boundMin;
+    uint leftFirst;
+    vec3 boundMax;
+    uint triangleCount;
+};
+layout (std430, binding = 4) buffer BVHBuffer {
+    BVHNode nodes[];
+};
+
+// rotation maps world space into model space including the inverse scale
 struct Model {
     uint triangleIndex;
     uint triangleCount;
-    uint padding[2];
+    uint nodeIndex;
+    uint materialIndex;
 
     vec4 boundMin;
     vec4 boundMax;
 
-    vec4 color_smoothness;
-    vec4 emissionColor_emissionStrength;
-    vec4 transmission_ior_metalness_tbd;
-
     vec4 translation;
     mat4 rotation;
-    mat4 inverseRotation;
 };
 layout (std430, binding = 2) buffer ModelBuffer {
     Model models[];
 };
 
+// all traversal keeps of the closest hit, resolveHit turns it into a HitInfo once it is final
+const uint NO_INSTANCE = 0xFFFFFFFFu;
+struct Hit {
+    float t;
+    // sphere index for spheres, triangle index for models
+    uint primitive;
+    // model index, NO_INSTANCE for spheres
+    uint instance;
+    vec2 barycentrics;
+};
+
 struct HitInfo {
     bool didHit;
     float t;
@@ -106,11 +188,35 @@ struct HitInfo {
 
 
 vec3 debugColor = vec3(0.0);
+// debugMode 1-3 are traversal cost heatmaps
+const int DEBUG_AMBIENT_OCCLUSION = 4;
+
+// a second of frames overflows 32 bits, so each total is a low, high word pair
+const uint STAT_RAYS = 0u;
+const uint STAT_NODE_VISITS = 1u;
+const uint STAT_TRIANGLE_TESTS = 2u;
+const uint STAT_BOUNCES = 3u;
+layout (std430, binding = 3) buffer RayStatsBuffer {
+    uint statTotals[8];
+    uint statMaxTriangleTests;
+};
+void addStat(uint stat, uint value) {
+    uint previous = atomicAdd(statTotals[2u * stat], value);
+    if (previous > 0xFFFFFFFFu - value) atomicAdd(statTotals[2u * stat + 1u], 1u);
+}
+layout (rgba32ui, binding = 0) uniform writeonly uimage2D uRayStatsImage;
+uint rayCount = 0u;
+uint nodeVisits = 0u;
+uint triangleTests = 0u;
+uint bounceCount = 0u;
+
+vec3 heatmap(float x) {
+    x = clamp(x, 0.0, 1.0);
+    return clamp(vec3(1.5 - abs(4.0 * x - 3.0), 1.5 - abs(4.0 * x - 2.0), 1.5 - abs(4.0 * x - 1.0)), 0.0, 1.0);
+}
 
-HitInfo intersectRaySphere(Ray ray, Sphere sphere, bool detectBackFace) {
-    HitInfo hitInfo;
-    hitInfo.didHit = false;
-
+// distance to the sphere along the ray, infinity when it misses or only hits at or beyond tMax
+float intersectRaySphere(Ray ray, Sphere sphere, bool detectBackFace, float tMax) {
     vec3 offsetRayOrigin = ray.origin - sphere.pos_radius.xyz;
     float a = dot(ray.dir, ray.dir);
     float b = 2 * dot(offsetRayOrigin, ray.dir);
@@ -119,113 +225,330 @@ HitInfo intersectRaySphere(Ray ray, Sphere sphere, bool detectBackFace) {
 
     if (discriminant > 0) {
         float t = (-b - sqrt(discriminant)) / (2 * a);
+        // the far intersection is further still
+        if (t >= tMax) return 1.0 / 0.0;
         if (t <= 0 && detectBackFace) {
             t = (-b + sqrt(discriminant)) / (2 * a);
         }
+        if (t > 0 && t < tMax) return t;
+    }
+    return 1.0 / 0.0;
+}
 
-        if (t > 0) {
-            hitInfo.didHit = true;
-            hitInfo.pos = ray.origin + ray.dir * t;
-            hitInfo.normal = normalize(hitInfo.pos - sphere.pos_radius.xyz);
-            hitInfo.isBackFace = dot(hitInfo.normal, ray.dir) > 0;
-            if (hitInfo.isBackFace) hitInfo.normal = -hitInfo.normal;
-            hitInfo.t = t;
-        }
+// the part of the triangle test that only depends on the ray, set up once per model
+struct TriangleRay {
+    vec3 origin;
+    vec3 dir;
+#if TRIANGLE_FORMAT == 2
+    // the axis the ray mostly runs along is z, the other two are kept in winding order
+    ivec3 axes;
+    // shears the ray onto +z, z scales it to unit length along it
+    vec3 shear;
+#endif
+};
+
+TriangleRay setupTriangleRay(Ray ray) {
+    TriangleRay triangleRay;
+    triangleRay.origin = ray.origin;
+    triangleRay.dir = ray.dir;
+#if TRIANGLE_FORMAT == 2
+    vec3 absDir = abs(ray.dir);
+    int z = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+    int x = (z + 1) % 3;
+    int y = (x + 1) % 3;
+    if (ray.dir[z] < 0.0) {
+        int swapAxis = x; x = y; y = swapAxis;
     }
-    return hitInfo;
+    triangleRay.axes = ivec3(x, y, z);
+    triangleRay.shear = vec3(ray.dir[x] / ray.dir[z], ray.dir[y] / ray.dir[z], 1.0 / ray.dir[z]);
+#endif
+    return triangleRay;
 }
 
-HitInfo intersectRayTriangle(Ray ray, Triangle triangle, bool detectBackFace) {
-    vec3 edgeAB = triangle.posB.xyz - triangle.posA.xyz;
-    vec3 edgeAC = triangle.posC.xyz - triangle.posA.xyz;
-    vec3 normalVector =  cross(edgeAB, edgeAC);
-    vec3 ao = ray.origin - triangle.posA.xyz;
+// t and the barycentrics of B and C, the normal is only interpolated for the closest hit
+bool intersectRayTriangle(TriangleRay ray, uint triangleIndex, bool detectBackFace, out float t, out vec2 barycentrics) {
+#if TRIANGLE_FORMAT == 2
+    // Woop, Benthin and Wald 2013: the edge functions are evaluated on the vertices in ray space,
+    // two triangles sharing an edge compute the same value for it and can't both miss
+    ivec3 axes = ray.axes;
+    vec3 a = triangles[triangleIndex].posA.xyz - ray.origin;
+    vec3 b = triangles[triangleIndex].posB.xyz - ray.origin;
+    vec3 c = triangles[triangleIndex].posC.xyz - ray.origin;
+    vec2 a2 = vec2(a[axes.x], a[axes.y]) - ray.shear.xy * a[axes.z];
+    vec2 b2 = vec2(b[axes.x], b[axes.y]) - ray.shear.xy * b[axes.z];
+    vec2 c2 = vec2(c[axes.x], c[axes.y]) - ray.shear.xy * c[axes.z];
+    // weights of A, B and C
+    float u = c2.x * b2.y - c2.y * b2.x;
+    float v = a2.x * c2.y - a2.y * c2.x;
+    float w = b2.x * a2.y - b2.y * a2.x;
+    // exactly on an edge, float rounding could decide either way
+    if (u == 0.0 || v == 0.0 || w == 0.0) {
+        u = float(double(c2.x) * double(b2.y) - double(c2.y) * double(b2.x));
+        v = float(double(a2.x) * double(c2.y) - double(a2.y) * double(c2.x));
+        w = float(double(b2.x) * double(a2.y) - double(b2.y) * double(a2.x));
+    }
+    if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) return false;
+
+    float determinant = u + v + w;
+    vec3 z = vec3(a[axes.z], b[axes.z], c[axes.z]) * ray.shear.z;
+    t = dot(vec3(u, v, w), z) / determinant;
+    barycentrics = vec2(v, w) / determinant;
+
+    bool validDet = detectBackFace ? determinant != 0.0 : determinant > 0.0;
+    return validDet && t > 0;
+#else
+#if TRIANGLE_FORMAT == 1
+    vec4 posA_normalX = triangleEdges[triangleIndex].posA_normalX;
+    vec4 edgeAB_normalY = triangleEdges[triangleIndex].edgeAB_normalY;
+    vec4 edgeAC_normalZ = triangleEdges[triangleIndex].edgeAC_normalZ;
+    vec3 posA = posA_normalX.xyz;
+    vec3 edgeAB = edgeAB_normalY.xyz;
+    vec3 edgeAC = edgeAC_normalZ.xyz;
+    vec3 normalVector = vec3(posA_normalX.w, edgeAB_normalY.w, edgeAC_normalZ.w);
+#else
+    vec3 posA = triangles[triangleIndex].posA.xyz;
+    vec3 edgeAB = triangles[triangleIndex].posB.xyz - posA;
+    vec3 edgeAC = triangles[triangleIndex].posC.xyz - posA;
+    vec3 normalVector = cross(edgeAB, edgeAC);
+#endif
+    vec3 ao = ray.origin - posA;
     vec3 dao = cross(ao, ray.dir);
 
     float determinant = -dot(ray.dir, normalVector);
     float invDet = 1.0 / determinant;
 
-    float t = dot(ao, normalVector) * invDet;
+    t = dot(ao, normalVector) * invDet;
     float u = dot(edgeAC, dao) * invDet;
     float v = -dot(edgeAB, dao) * invDet;
     float w = 1.0 - u - v;
+    barycentrics = vec2(u, v);
 
-    HitInfo hitInfo;
     bool validDet = detectBackFace ? abs(determinant) >= 1e-6 : determinant >= 1e-6;
-    hitInfo.didHit = validDet && t > 0 && u >= 0 && v >= 0 && w >= 0;
-    hitInfo.pos = ray.origin + ray.dir * t;
-    hitInfo.normal = normalize(triangle.normalA.xyz * w + triangle.normalB.xyz * u + triangle.normalC.xyz * v) * (determinant < 0.0 ? -1 : 1);
-    hitInfo.isBackFace = determinant < 0.0;
-    hitInfo.t = t;
-    return hitInfo;
+    return validDet && t > 0 && u >= 0 && v >= 0 && w >= 0;
+#endif
 }
 
-bool intersectRayBox(Ray ray, vec3 boxMin, vec3 boxMax) {
-    vec3 invDir = 1 / ray.dir;
+// entry distance of the ray into a box, infinity when it misses or the box is behind the ray
+float intersectRayBox(Ray ray, vec3 invDir, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - ray.origin) * invDir;
     vec3 tMax = (boxMax - ray.origin) * invDir;
     vec3 t1 = min(tMin, tMax);
     vec3 t2 = max(tMin, tMax);
     float tNear = max(max(t1.x, t1.y), t1.z);
     float tFar = min(min(t2.x, t2.y), t2.z);
-    return tNear <= tFar;
+    return tNear <= tFar && tFar > 0 ? tNear : 1.0 / 0.0;
+}
+
+float intersectRayNode(Ray ray, vec3 invDir, BVHNode node) {
+    return intersectRayBox(ray, invDir, node.boundMin, node.boundMax);
 }
 
-uniform vec3 modelMin;
-uniform vec3 modelMax;
+Material fetchMaterial(uint materialIndex) {
+    MaterialRecord record = materials[materialIndex];
+    Material material;
+    material.color = record.color_roughness.rgb;
+    material.emissionColor = record.emissionColor_emissionStrength.rgb;
+    material.emissionStrength = record.emissionColor_emissionStrength.a;
+    material.roughness = record.color_roughness.a;
+    material.transmission = record.transmission_ior_metalness_tbd.r;
+    material.ior = record.transmission_ior_metalness_tbd.g;
+    material.metalness = record.transmission_ior_metalness_tbd.b;
+    return material;
+}
+
+// position, shading normal and material of the closest hit; the position comes from the world
+// space ray, t is the same along the model space one
+HitInfo resolveHit(Ray ray, Hit hit) {
+    HitInfo hitInfo;
+    hitInfo.didHit = hit.t < 1.0 / 0.0;
+    if (!hitInfo.didHit) return hitInfo;
+    hitInfo.t = hit.t;
+    hitInfo.pos = ray.origin + ray.dir * hit.t;
+    uint materialIndex;
+    if (hit.instance == NO_INSTANCE) {
+        Sphere sphere = spheres[hit.primitive];
+        hitInfo.normal = normalize(hitInfo.pos - sphere.pos_radius.xyz);
+        hitInfo.isBackFace = dot(hitInfo.normal, ray.dir) > 0;
+        materialIndex = sphere.materialIndex;
+    } else {
+        Model model = models[hit.instance];
+        Triangle triangle = triangles[hit.primitive];
+        vec3 localDir = mat3(model.rotation) * ray.dir;
+        vec3 normalVector = cross(triangle.posB.xyz - triangle.posA.xyz, triangle.posC.xyz - triangle.posA.xyz);
+        hitInfo.isBackFace = dot(localDir, normalVector) > 0.0;
+        float u = hit.barycentrics.x;
+        float v = hit.barycentrics.y;
+        vec3 normal = triangle.normalA.xyz * (1.0 - u - v) + triangle.normalB.xyz * u + triangle.normalC.xyz * v;
+        hitInfo.normal = normalize(transpose(mat3(model.rotation)) * normal);
+        materialIndex = model.materialIndex;
+    }
+    if (hitInfo.isBackFace) hitInfo.normal = -hitInfo.normal;
+    hitInfo.material = fetchMaterial(materialIndex);
+    return hitInfo;
+}
+
+// searches the BVH of one model, t is measured along the world space ray for every model
+void traverseModel(Ray ray, uint modelIndex, bool detectBackFace, inout Hit closestHit) {
+    Model model = models[modelIndex];
+    Ray localRay;
+    localRay.origin = ray.origin - model.translation.xyz;
+    localRay.origin = mat3(model.rotation) * localRay.origin;
+    localRay.dir = mat3(model.rotation) * ray.dir;
+
+    TriangleRay triangleRay = setupTriangleRay(localRay);
+
+    // near child first, the far one is skipped once a closer hit is known
+    vec3 invDir = 1 / localRay.dir;
+    uint stack[32];
+    float stackDist[32];
+    int stackSize = 0;
+    uint nodeIndex = model.nodeIndex;
+    while (true) {
+        BVHNode node = nodes[nodeIndex];
+        if (node.triangleCount > 0) {
+            triangleTests += node.triangleCount;
+            for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                float t;
+                vec2 barycentrics;
+                if (intersectRayTriangle(triangleRay, i, detectBackFace, t, barycentrics) && t < closestHit.t) {
+                    closestHit.t = t;
+                    closestHit.primitive = i;
+                    closestHit.instance = modelIndex;
+                    closestHit.barycentrics = barycentrics;
+                }
+            }
+        } else {
+            uint nearChild = node.leftFirst;
+            uint farChild = node.leftFirst + 1;
+            nodeVisits += 2;
+            float nearDist = intersectRayNode(localRay, invDir, nodes[nearChild]);
+            float farDist = intersectRayNode(localRay, invDir, nodes[farChild]);
+            if (farDist < nearDist) {
+                uint swapChild = nearChild; nearChild = farChild; farChild = swapChild;
+                float swapDist = nearDist; nearDist = farDist; farDist = swapDist;
+            }
+            if (nearDist < closestHit.t) {
+                if (farDist < closestHit.t) {
+                    stack[stackSize] = farChild;
+                    stackDist[stackSize++] = farDist;
+                }
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+        while (stackSize > 0 && stackDist[stackSize - 1] >= closestHit.t) stackSize--;
+        if (stackSize == 0) break;
+        nodeIndex = stack[--stackSize];
+    }
+}
+
+// models whose box the ray enters before the closest hit so far are kept sorted by entry distance,
+// a model pushed out of the full list is searched right away
+const uint MAX_SORTED_MODELS = 8u;
+
 HitInfo calculateRayIntersection(Ray ray, bool detectBackFace) {
-    HitInfo closestHit;
-    closestHit.didHit = false;
+    rayCount++;
+    Hit closestHit;
     closestHit.t = 1.0 / 0.0;
 
-    for (int i = 0; i < spheres.length(); i++) {
-        Sphere sphere = spheres[i];
-        HitInfo hitInfo = intersectRaySphere(ray, sphere, detectBackFace);
-        if (hitInfo.didHit && hitInfo.t < closestHit.t) {
-            closestHit = hitInfo;
-            Material material;
-            material.color = sphere.color_smoothness.rgb;
-            material.emissionColor = sphere.emissionColor_emissionStrength.rgb;
-            material.emissionStrength = sphere.emissionColor_emissionStrength.a;
-            material.roughness = sphere.color_smoothness.a;
-            material.transmission = sphere.transmission_ior_metalness_tbd.r;
-            material.ior = sphere.transmission_ior_metalness_tbd.g;
-            material.metalness = sphere.transmission_ior_metalness_tbd.b;
-            closestHit.material = material;
+#if SCENE_HAS_SPHERES
+    for (uint i = 0; i < sphereCount; i++) {
+        float t = intersectRaySphere(ray, spheres[i], detectBackFace, closestHit.t);
+        if (t < closestHit.t) {
+            closestHit.t = t;
+            closestHit.primitive = i;
+            closestHit.instance = NO_INSTANCE;
         }
     }
-    for (int modelIndex = 0; modelIndex < models.length(); modelIndex++) {
-        bool didHitModel = false;
+#endif
+#if SCENE_HAS_MODELS
+    // nearest box first, so the closest hit is found early and culls the models behind it
+    uint sortedModels[MAX_SORTED_MODELS];
+    float sortedDist[MAX_SORTED_MODELS];
+    uint sortedCount = 0u;
+    for (uint modelIndex = 0; modelIndex < modelCount; modelIndex++) {
         Model model = models[modelIndex];
         Ray localRay;
-        localRay.origin = ray.origin - model.translation.xyz;
-        localRay.origin = mat3(model.rotation) * localRay.origin;
+        localRay.origin = mat3(model.rotation) * (ray.origin - model.translation.xyz);
         localRay.dir = mat3(model.rotation) * ray.dir;
-        if (!intersectRayBox(localRay, model.boundMin.xyz, model.boundMax.xyz)) continue;
-        for (uint i = model.triangleIndex; i < model.triangleIndex+model.triangleCount; i++) {
-            Triangle triangle = triangles[i];
-            HitInfo hitInfo = intersectRayTriangle(localRay, triangle, detectBackFace);
-            if (hitInfo.didHit && hitInfo.t < closestHit.t) {
-                didHitModel = true;
-                closestHit = hitInfo;
-                Material material;
-                material.color = model.color_smoothness.rgb;
-                material.emissionColor = model.emissionColor_emissionStrength.rgb;
-                material.emissionStrength = model.emissionColor_emissionStrength.a;
-                material.roughness = model.color_smoothness.a;
-                material.transmission = model.transmission_ior_metalness_tbd.r;
-                material.ior = model.transmission_ior_metalness_tbd.g;
-                material.metalness = model.transmission_ior_metalness_tbd.b;
-                closestHit.material = material;
+        nodeVisits++;
+        float dist = intersectRayBox(localRay, 1 / localRay.dir, model.boundMin.xyz, model.boundMax.xyz);
+        if (dist >= closestHit.t) continue;
+        if (sortedCount == MAX_SORTED_MODELS) {
+            if (dist >= sortedDist[sortedCount - 1u]) {
+                traverseModel(ray, modelIndex, detectBackFace, closestHit);
+                continue;
             }
+            sortedCount--;
+            if (sortedDist[sortedCount] < closestHit.t)
+                traverseModel(ray, sortedModels[sortedCount], detectBackFace, closestHit);
         }
-        if (didHitModel) {
-            closestHit.pos = mat3(model.inverseRotation) * closestHit.pos;
-            closestHit.pos += model.translation.xyz;
-            closestHit.normal = normalize(mat3(model.inverseRotation) * closestHit.normal);
+        uint slot = sortedCount++;
+        while (slot > 0u && sortedDist[slot - 1u] > dist) {
+            sortedModels[slot] = sortedModels[slot - 1u];
+            sortedDist[slot] = sortedDist[slot - 1u];
+            slot--;
         }
+        sortedModels[slot] = modelIndex;
+        sortedDist[slot] = dist;
     }
-    return closestHit;
+    for (uint i = 0u; i < sortedCount && sortedDist[i] < closestHit.t; i++)
+        traverseModel(ray, sortedModels[i], detectBackFace, closestHit);
+#endif
+    return resolveHit(ray, closestHit);
+}
+
+// any-hit search of one model for visibility rays, the first triangle closer than tMax ends it
+bool occludedByModel(Ray ray, uint modelIndex, float tMax) {
+    Model model = models[modelIndex];
+    Ray localRay;
+    localRay.origin = mat3(model.rotation) * (ray.origin - model.translation.xyz);
+    localRay.dir = mat3(model.rotation) * ray.dir;
+    vec3 invDir = 1 / localRay.dir;
+    nodeVisits++;
+    if (intersectRayBox(localRay, invDir, model.boundMin.xyz, model.boundMax.xyz) >= tMax) return false;
+    TriangleRay triangleRay = setupTriangleRay(localRay);
+
+    uint stack[32];
+    int stackSize = 0;
+    uint nodeIndex = model.nodeIndex;
+    while (true) {
+        BVHNode node = nodes[nodeIndex];
+        if (node.triangleCount > 0) {
+            triangleTests += node.triangleCount;
+            for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                float t;
+                vec2 barycentrics;
+                if (intersectRayTriangle(triangleRay, i, true, t, barycentrics) && t < tMax) return true;
+            }
+        } else {
+            nodeVisits += 2;
+            bool hitLeft = intersectRayNode(localRay, invDir, nodes[node.leftFirst]) < tMax;
+            bool hitRight = intersectRayNode(localRay, invDir, nodes[node.leftFirst + 1]) < tMax;
+            if (hitLeft && hitRight) stack[stackSize++] = node.leftFirst + 1;
+            if (hitLeft || hitRight) {
+                nodeIndex = hitLeft ? node.leftFirst : node.leftFirst + 1;
+                continue;
+            }
+        }
+        if (stackSize == 0) return false;
+        nodeIndex = stack[--stackSize];
+    }
+}
+
+// whether anything lies along the ray before tMax, for shadow and visibility rays; front and back
+// faces both block and no hit record or material is built
+bool occluded(Ray ray, float tMax) {
+    rayCount++;
+#if SCENE_HAS_SPHERES
+    for (uint i = 0; i < sphereCount; i++)
+        if (intersectRaySphere(ray, spheres[i], true, tMax) < tMax) return true;
+#endif
+#if SCENE_HAS_MODELS
+    for (uint modelIndex = 0; modelIndex < modelCount; modelIndex++)
+        if (occludedByModel(ray, modelIndex, tMax)) return true;
+#endif
+    return false;
 }
 
 float fresnelReflection(vec3 wi, vec3 normal, float iorI, float iorT) {
@@ -304,8 +627,13 @@ vec3 GetEnvironmentLight(Ray ray) {
     return mix(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.7, 1.0), a);
 }
 
-uniform int maxBounces_reflection;
-uniform int maxBounces_transmission;
+#ifdef MAX_BOUNCES_REFLECTION
+const int maxBounces_reflection = MAX_BOUNCES_REFLECTION;
+const int maxBounces_transmission = MAX_BOUNCES_TRANSMISSION;
+#else
+#define maxBounces_reflection uMaxBounces_reflection
+#define maxBounces_transmission uMaxBounces_transmission
+#endif
 vec3 traceRay(Ray ray, inout uint rngState) {
     vec3 inLight = vec3(0.0);
     vec3 rayColor = vec3(1.0);
@@ -317,17 +645,18 @@ vec3 traceRay(Ray ray, inout uint rngState) {
         Material material = hitInfo.material;
 
         if (hitInfo.didHit) {
+            bounceCount++;
             vec3 microsurfaceNormal = sampleGGXnormal(hitInfo.normal, -ray.dir, vec2(RandomValue(rngState), RandomValue(rngState)), vec2(material.roughness));
             if (material.roughness < 0.01) microsurfaceNormal = hitInfo.normal;
 
             vec3 diffuseDir = normalize(hitInfo.normal + RandomDirection(rngState));
             vec3 specularReflectionDir = reflect(ray.dir, microsurfaceNormal);
-            vec3 specularTransmissionDir = refract(ray.dir, microsurfaceNormal, isInsideMedium ? material.ior : 1.0/material.ior);
 
             vec3 emittedLight = material.emissionColor * material.emissionStrength;
             inLight += emittedLight * rayColor;
 
-            if (RandomValue(rngState) < material.metalness) {
+            float metalRoll = RandomValue(rngState);
+            if (SCENE_HAS_METAL != 0 && metalRoll < material.metalness) {
                 if (dot(specularReflectionDir, hitInfo.normal) < 0.0) break;
                 ray.dir = specularReflectionDir;
                 rayColor *= material.color;
@@ -339,8 +668,9 @@ vec3 traceRay(Ray ray, inout uint rngState) {
                     rayColor *= vec3(1.0);
                     reflectionBounces++;
                 } else {
-                    if (RandomValue(rngState) < material.transmission) {
-                        ray.dir = specularTransmissionDir;
+                    float transmissionRoll = RandomValue(rngState);
+                    if (SCENE_HAS_TRANSMISSION != 0 && transmissionRoll < material.transmission) {
+                        ray.dir = refract(ray.dir, microsurfaceNormal, isInsideMedium ? material.ior : 1.0/material.ior);
                         transmissionBounces++;
                         isInsideMedium = !isInsideMedium;
                         rayColor *= material.color;
@@ -361,26 +691,84 @@ vec3 traceRay(Ray ray, inout uint rngState) {
     return inLight;
 }
 
-uniform sampler2D uPrevFrame;
-uniform uint renderedFrames;
-uniform int samplesPerPixel;
-uniform bool accumulate;
+// debug view: whether a cosine weighted direction above the first hit leaves without hitting
+// anything within debugHeatmapMax, averaged over the accumulated samples
+vec3 ambientOcclusion(Ray ray, inout uint rngState) {
+    HitInfo hitInfo = calculateRayIntersection(ray, false);
+    if (!hitInfo.didHit) return vec3(1.0);
+    bounceCount++;
+    Ray occlusionRay;
+    occlusionRay.dir = normalize(hitInfo.normal + RandomDirection(rngState));
+    // off the surface along the normal, the query counts back faces as well
+    occlusionRay.origin = hitInfo.pos + hitInfo.normal * 1e-4;
+    return occluded(occlusionRay, debugHeatmapMax) ? vec3(0.0) : vec3(1.0);
+}
+
+// the accumulation textures hold the mean radiance in rgb and the per-pixel sample count in a
+layout (binding = 0) uniform sampler2D uPrevFrame;
+
+// hybrid rendering: rows at or above cpuRowStart are traced by the CPU, its finished batches
+// arrive in uCpuSamples (radiance sum in rgb, sample count in a) for rows at or above cpuBatchRowStart
+layout (binding = 1) uniform sampler2D uCpuSamples;
+// the direction the full-screen quad would interpolate from its corners at imageUV, independent
+// of which tile is being rendered
+vec3 cameraRayDir(vec2 imageUV) {
+    vec2 resolution = vec2(uResolution);
+    mat3 cameraBasis = mat3(cameraRight, cameraUp, cameraForward);
+    vec3 dirBL = cameraBasis * normalize(vec3(resolution * vec2(0, 0) - resolution * .5, uFocalLength));
+    vec3 dirBR = cameraBasis * normalize(vec3(resolution * vec2(1, 0) - resolution * .5, uFocalLength));
+    vec3 dirTL = cameraBasis * normalize(vec3(resolution * vec2(0, 1) - resolution * .5, uFocalLength));
+    vec3 dirTR = cameraBasis * normalize(vec3(resolution * vec2(1, 1) - resolution * .5, uFocalLength));
+    return imageUV.x + imageUV.y >= 1.0
+        ? dirBR * (1.0 - imageUV.y) + dirTL * (1.0 - imageUV.x) + dirTR * (imageUV.x + imageUV.y - 1.0)
+        : dirBL * (1.0 - imageUV.x - imageUV.y) + dirBR * imageUV.x + dirTL * imageUV.y;
+}
+
 void main() {
-    uvec2 pixelCoord = uvec2(uv * uResolution);
-    uint rngState = pixelCoord.x * uResolution.x + pixelCoord.y + renderedFrames * 719393u;
+    uvec2 texel = uvec2(uv * vec2(textureSize(uPrevFrame, 0)));
+    uvec2 pixelCoord = uTileOffset + texel;
+    vec3 rayDir = cameraRayDir((vec2(pixelCoord) + 0.5) / vec2(uResolution));
+    uint rngState = pixelCoord.x * uResolution.x + pixelCoord.y + (renderedFrames + frameOffset) * 719393u;
+
+    vec4 prev = texture(uPrevFrame, uv);
+    float prevCount = renderedFrames == 0u ? 0.0 : prev.a;
+    vec3 sum = prev.rgb * prevCount;
+    float count = prevCount;
+
+    if (cpuSamplesReady && pixelCoord.y >= cpuBatchRowStart) {
+        vec4 cpuSamples = texelFetch(uCpuSamples, ivec2(texel), 0);
+        sum += cpuSamples.rgb;
+        count += cpuSamples.a;
+    }
 
-    Ray ray = {cameraPosition, vec3(rayDir.xy + RandomDirectionInCircle(rngState)/uResolution.x, rayDir.z)};
+    // pixels owned by the CPU are still traced here until they have a first sample
+    if (pixelCoord.y < cpuRowStart || count == 0.0) {
+        Ray ray = {cameraPosition, vec3(rayDir.xy + RandomDirectionInCircle(rngState)/uResolution.x, rayDir.z)};
 
-    vec3 curr = vec3(0);
-    for (int i = 0; i < samplesPerPixel; i++)
-        curr += traceRay(ray, rngState);
-    curr /= samplesPerPixel;
+        vec3 curr = vec3(0);
+        for (int i = 0; i < samplesPerPixel; i++)
+            curr += debugMode == DEBUG_AMBIENT_OCCLUSION ? ambientOcclusion(ray, rngState) : traceRay(ray, rngState);
 
-    if (debugColor != vec3(0.0))
-        curr = debugColor;
+        if (debugMode != 0) {
+            if (debugMode != DEBUG_AMBIENT_OCCLUSION) {
+                uint counts[3] = uint[3](nodeVisits, triangleTests, bounceCount);
+                float perSample = float(counts[debugMode - 1]) / samplesPerPixel;
+                debugColor = heatmap(log2(1.0 + perSample) / log2(1.0 + debugHeatmapMax));
+            }
+            imageStore(uRayStatsImage, ivec2(texel), uvec4(nodeVisits, triangleTests, bounceCount, rayCount));
+            addStat(STAT_RAYS, rayCount);
+            addStat(STAT_NODE_VISITS, nodeVisits);
+            addStat(STAT_TRIANGLE_TESTS, triangleTests);
+            addStat(STAT_BOUNCES, bounceCount);
+            atomicMax(statMaxTriangleTests, triangleTests);
+        }
+
+        if (debugColor != vec3(0.0))
+            curr = debugColor * samplesPerPixel;
+
+        sum += curr;
+        count += samplesPerPixel;
+    }
 
-    vec3 prev = texture(uPrevFrame, uv).rgb;
-    float alpha = 1.0 / float(renderedFrames + 1u);
-    vec3 blended = mix(prev, curr, alpha);
-    FragColor = vec4(blended, 1.0);
+    FragColor = vec4(sum / count, count);
 }
\ No newline at end of file
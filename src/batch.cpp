@@ -0,0 +1,63 @@
+#include "batch.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "trace.h"
+
+
+static const char BATCH_MAGIC[4] = {'R', 'T', 'S', 'B'};
+static const uint32_t BATCH_VERSION = 1;
+
+// takes the accumulation as read back, mean radiance in rgb
+bool writeBatchFile(const std::string &path, const std::string &metadata, uint width, uint height, const std::vector<float> &accumulation) {
+    BatchInfo info;
+    if (metadata.size() != sizeof(BatchInfo)) return false;
+    std::memcpy(&info, metadata.data(), sizeof(BatchInfo));
+    std::vector<float> sums(accumulation);
+    for (size_t i = 0; i < sums.size(); i += 4)
+        for (int c = 0; c < 3; c++)
+            sums[i + c] *= sums[i + 3];
+    return writeBatch(path, info, width, height, sums);
+}
+
+bool writeBatch(const std::string &path, const BatchInfo &info, uint width, uint height, const std::vector<float> &sums) {
+    TRACE_SCOPE("writeBatch");
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) return false;
+    uint32_t header[3] = {BATCH_VERSION, width, height};
+    bool ok = fwrite(BATCH_MAGIC, 1, 4, file) == 4;
+    ok = ok && fwrite(header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(&info, sizeof(BatchInfo), 1, file) == 1;
+    ok = ok && fwrite(sums.data(), sizeof(float), sums.size(), file) == sums.size();
+    ok = fclose(file) == 0 && ok;
+    return ok && std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+bool readBatch(const std::string &path, BatchInfo &info, uint &width, uint &height, std::vector<float> &sums) {
+    TRACE_SCOPE("readBatch");
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cout << "ERROR::BATCH::FILE_NOT_SUCCESSFULLY_OPENED: " << path << std::endl;
+        return false;
+    }
+    char magic[4];
+    uint32_t header[3];
+    bool ok = fread(magic, 1, 4, file) == 4 && std::memcmp(magic, BATCH_MAGIC, 4) == 0;
+    ok = ok && fread(header, sizeof(header), 1, file) == 1 && header[0] == BATCH_VERSION;
+    ok = ok && fread(&info, sizeof(BatchInfo), 1, file) == 1;
+    if (ok) {
+        width = header[1];
+        height = header[2];
+        sums.resize(4 * (size_t)width * height);
+        ok = fread(sums.data(), sizeof(float), sums.size(), file) == sums.size();
+    }
+    fclose(file);
+    if (!ok) std::cout << "ERROR::BATCH::INVALID_FILE: " << path << std::endl;
+    return ok;
+}
+
+std::string batchMetadata(const BatchInfo &info) {
+    return std::string((const char*)&info, sizeof(BatchInfo));
+}
@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// One node's share of a distributed render: the frames firstFrame .. firstFrame + frameCount - 1
+// of the sequence a single node would render, so batches with disjoint ranges never share samples.
+struct BatchInfo {
+    uint64_t sceneHash;
+    uint firstFrame;
+    uint frameCount;
+};
+
+// A .rtsb file is "RTSB", a version, the image size, the BatchInfo and RGBA floats holding the
+// radiance sum in rgb and the sample count in a, bottom row first. Sums add up, so batches merge
+// in any order and a merged file is itself a batch.
+bool writeBatchFile(const std::string &path, const std::string &metadata, uint width, uint height, const std::vector<float> &accumulation);
+bool readBatch(const std::string &path, BatchInfo &info, uint &width, uint &height, std::vector<float> &sums);
+bool writeBatch(const std::string &path, const BatchInfo &info, uint width, uint height, const std::vector<float> &sums);
+std::string batchMetadata(const BatchInfo &info);
+
+#endif
@@ -0,0 +1,189 @@
+#include "bvh.h"
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#include "trace.h"
+
+
+static const uint BIN_COUNT = 12;
+// leaves bigger than this are split even when the SAH says it does not pay off
+static const uint MAX_LEAF_SIZE = 16;
+
+static float halfArea(vec3 boundMin, vec3 boundMax) {
+    vec3 extent = boundMax - boundMin;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static void leafBounds(const std::vector<Triangle> &triangles, BVHNode &node) {
+    node.boundMin = vec3(std::numeric_limits<float>::infinity());
+    node.boundMax = vec3(-std::numeric_limits<float>::infinity());
+    for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+        const Triangle &triangle = triangles[i];
+        node.boundMin = min(node.boundMin, min(vec3(triangle.pos_uvx_A), min(vec3(triangle.pos_uvx_B), vec3(triangle.pos_uvx_C))));
+        node.boundMax = max(node.boundMax, max(vec3(triangle.pos_uvx_A), max(vec3(triangle.pos_uvx_B), vec3(triangle.pos_uvx_C))));
+    }
+}
+
+struct BVHBuilder {
+    std::vector<Triangle> &triangles;
+    std::vector<BVHNode> &nodes;
+    std::vector<vec3> centroids;
+    uint firstTriangle;
+
+    vec3 centroid(uint i) {
+        return centroids[i - firstTriangle];
+    }
+
+    void updateBounds(uint nodeIndex) {
+        leafBounds(triangles, nodes[nodeIndex]);
+    }
+
+    void subdivide(uint nodeIndex, uint depth) {
+        BVHNode node = nodes[nodeIndex];
+        if (node.triangleCount <= 1 || depth + 1 >= BVH_MAX_DEPTH) return;
+
+        vec3 centroidMin = vec3(std::numeric_limits<float>::infinity());
+        vec3 centroidMax = vec3(-std::numeric_limits<float>::infinity());
+        for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+            centroidMin = min(centroidMin, centroid(i));
+            centroidMax = max(centroidMax, centroid(i));
+        }
+
+        // binned SAH: sweep BIN_COUNT - 1 candidate planes on every axis
+        int bestAxis = -1;
+        uint bestSplit = 0;
+        float bestCost = std::numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroidMax[axis] <= centroidMin[axis]) continue;
+            float binScale = BIN_COUNT / (centroidMax[axis] - centroidMin[axis]);
+
+            vec3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+            uint binCount[BIN_COUNT] = {};
+            for (uint b = 0; b < BIN_COUNT; b++) {
+                binMin[b] = vec3(std::numeric_limits<float>::infinity());
+                binMax[b] = vec3(-std::numeric_limits<float>::infinity());
+            }
+            for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                const Triangle &triangle = triangles[i];
+                uint b = std::min(BIN_COUNT - 1, (uint)((centroid(i)[axis] - centroidMin[axis]) * binScale));
+                binCount[b]++;
+                binMin[b] = min(binMin[b], min(vec3(triangle.pos_uvx_A), min(vec3(triangle.pos_uvx_B), vec3(triangle.pos_uvx_C))));
+                binMax[b] = max(binMax[b], max(vec3(triangle.pos_uvx_A), max(vec3(triangle.pos_uvx_B), vec3(triangle.pos_uvx_C))));
+            }
+
+            float leftCost[BIN_COUNT - 1];
+            vec3 boundMin = vec3(std::numeric_limits<float>::infinity());
+            vec3 boundMax = vec3(-std::numeric_limits<float>::infinity());
+            uint count = 0;
+            for (uint b = 0; b < BIN_COUNT - 1; b++) {
+                count += binCount[b];
+                boundMin = min(boundMin, binMin[b]);
+                boundMax = max(boundMax, binMax[b]);
+                leftCost[b] = count > 0 ? count * halfArea(boundMin, boundMax) : 0.0f;
+            }
+            boundMin = vec3(std::numeric_limits<float>::infinity());
+            boundMax = vec3(-std::numeric_limits<float>::infinity());
+            count = 0;
+            for (uint b = BIN_COUNT - 1; b > 0; b--) {
+                count += binCount[b];
+                boundMin = min(boundMin, binMin[b]);
+                boundMax = max(boundMax, binMax[b]);
+                float cost = leftCost[b - 1] + (count > 0 ? count * halfArea(boundMin, boundMax) : 0.0f);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+        if (bestAxis < 0) return;
+        float leafCost = node.triangleCount * halfArea(node.boundMin, node.boundMax);
+        if (bestCost >= leafCost && node.triangleCount <= MAX_LEAF_SIZE) return;
+
+        float binScale = BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint i = node.leftFirst;
+        uint j = node.leftFirst + node.triangleCount;
+        while (i < j) {
+            uint b = std::min(BIN_COUNT - 1, (uint)((centroid(i)[bestAxis] - centroidMin[bestAxis]) * binScale));
+            if (b < bestSplit) {
+                i++;
+            } else {
+                j--;
+                std::swap(triangles[i], triangles[j]);
+                std::swap(centroids[i - firstTriangle], centroids[j - firstTriangle]);
+            }
+        }
+        uint leftCount = i - node.leftFirst;
+        if (leftCount == 0 || leftCount == node.triangleCount) return;
+
+        uint leftChild = nodes.size();
+        nodes.push_back({vec3(0.0), node.leftFirst, vec3(0.0), leftCount});
+        nodes.push_back({vec3(0.0), i, vec3(0.0), node.triangleCount - leftCount});
+        nodes[nodeIndex].leftFirst = leftChild;
+        nodes[nodeIndex].triangleCount = 0;
+        updateBounds(leftChild);
+        updateBounds(leftChild + 1);
+        subdivide(leftChild, depth + 1);
+        subdivide(leftChild + 1, depth + 1);
+    }
+};
+
+uint buildBVH(std::vector<Triangle> &triangles, uint triangleIndex, uint triangleCount, std::vector<BVHNode> &nodes) {
+    TRACE_SCOPE("buildBVH");
+    BVHBuilder builder = {triangles, nodes, {}, triangleIndex};
+    builder.centroids.reserve(triangleCount);
+    for (uint i = triangleIndex; i < triangleIndex + triangleCount; i++)
+        builder.centroids.push_back((vec3(triangles[i].pos_uvx_A) + vec3(triangles[i].pos_uvx_B) + vec3(triangles[i].pos_uvx_C)) / 3.0f);
+
+    uint root = nodes.size();
+    nodes.reserve(nodes.size() + 2 * (size_t)triangleCount);
+    nodes.push_back({vec3(0.0), triangleIndex, vec3(0.0), triangleCount});
+    builder.updateBounds(root);
+    builder.subdivide(root, 0);
+    return root;
+}
+
+void refitBVH(const std::vector<Triangle> &triangles, std::vector<BVHNode> &nodes, uint nodeIndex, uint nodeCount) {
+    TRACE_SCOPE("refitBVH");
+    // children are always allocated after their parent, so a reverse sweep is bottom up
+    auto refitLeaves = [&](uint first, uint last) {
+        for (uint i = first; i < last; i++)
+            if (nodes[i].triangleCount > 0) leafBounds(triangles, nodes[i]);
+    };
+    uint threadCount = nodeCount < 4096 ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    uint chunk = (nodeCount + threadCount - 1) / threadCount;
+    std::vector<std::thread> workers;
+    for (uint t = 1; t < threadCount; t++)
+        workers.emplace_back(refitLeaves, nodeIndex + std::min(nodeCount, t * chunk), nodeIndex + std::min(nodeCount, (t + 1) * chunk));
+    refitLeaves(nodeIndex, nodeIndex + std::min(nodeCount, chunk));
+    for (std::thread &worker : workers)
+        worker.join();
+
+    for (uint i = nodeIndex + nodeCount; i-- > nodeIndex;) {
+        BVHNode &node = nodes[i];
+        if (node.triangleCount > 0) continue;
+        node.boundMin = min(nodes[node.leftFirst].boundMin, nodes[node.leftFirst + 1].boundMin);
+        node.boundMax = max(nodes[node.leftFirst].boundMax, nodes[node.leftFirst + 1].boundMax);
+    }
+}
+
+float costBVH(const std::vector<BVHNode> &nodes, uint nodeIndex) {
+    float cost = 0.0f;
+    std::vector<uint> stack = {nodeIndex};
+    while (!stack.empty()) {
+        const BVHNode &node = nodes[stack.back()];
+        stack.pop_back();
+        float area = halfArea(node.boundMin, node.boundMax);
+        if (node.triangleCount > 0) {
+            cost += area * node.triangleCount;
+        } else {
+            cost += area;
+            stack.push_back(node.leftFirst);
+            stack.push_back(node.leftFirst + 1);
+        }
+    }
+    float rootArea = halfArea(nodes[nodeIndex].boundMin, nodes[nodeIndex].boundMax);
+    return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
@@ -0,0 +1,35 @@
+#ifndef BVH_H
+#define BVH_H
+#include <vector>
+
+#include "objParser.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// matches BVHNode in raytrace.frag. Leaves have triangleCount > 0 and hold the triangles starting at
+// leftFirst, inner nodes have triangleCount == 0 and their two children at leftFirst and leftFirst + 1.
+struct BVHNode {
+    vec3 boundMin;
+    uint leftFirst;
+    vec3 boundMax;
+    uint triangleCount;
+};
+
+// raytrace.frag keeps a fixed size traversal stack, the builder never goes deeper than this
+const uint BVH_MAX_DEPTH = 32;
+
+// builds a binned SAH BVH over triangles[triangleIndex, triangleIndex + triangleCount), reordering
+// them in place. The nodes are appended to `nodes`, the index of the root is returned.
+uint buildBVH(std::vector<Triangle> &triangles, uint triangleIndex, uint triangleCount, std::vector<BVHNode> &nodes);
+
+// recomputes the bounds of nodes[nodeIndex, nodeIndex + nodeCount) bottom up after their triangles
+// moved, keeping the topology. Leaves are refit on all cores for big trees.
+void refitBVH(const std::vector<Triangle> &triangles, std::vector<BVHNode> &nodes, uint nodeIndex, uint nodeCount);
+
+// SAH cost of the tree below nodeIndex relative to its root box, grows as a refit tree degrades
+float costBVH(const std::vector<BVHNode> &nodes, uint nodeIndex);
+
+inline std::vector<BVHNode> bvhNodes;
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <cmath>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+struct Camera {
+    vec3 position;
+    vec3 forward;
+    vec3 up;
+    vec3 right;
+    uvec2 resolution;
+    float focalLength;
+};
+
+// pitch about x, then yaw about y, in degrees, with the 45 degree vertical field of view of the window
+inline Camera makeCamera(vec3 position, float pitch, float yaw, uvec2 resolution) {
+    auto rotate = [pitch, yaw](vec3 v) {
+        float x = radians(pitch), y = radians(yaw);
+        v = vec3(v.x, v.y*cos(x) - v.z*sin(x), v.y*sin(x) + v.z*cos(x));
+        return vec3(v.x*cos(y) - v.z*sin(y), v.y, v.x*sin(y) + v.z*cos(y));
+    };
+    return {position, rotate(vec3(0, 0, 1)), rotate(vec3(0, 1, 0)), rotate(vec3(1, 0, 0)), resolution,
+            (float)(tan(45.0 / 180.0 * 3.1415926)*.5 * (float)resolution.y)};
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "trace.h"
+
+
+static const char CHECKPOINT_MAGIC[4] = {'R', 'T', 'C', 'K'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+bool writeCheckpointFile(const std::string &path, const std::string &metadata, uint width, uint height, const std::vector<float> &pixels) {
+    TRACE_SCOPE("writeCheckpoint");
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) return false;
+    uint32_t header[4] = {CHECKPOINT_VERSION, width, height, (uint32_t)metadata.size()};
+    bool ok = fwrite(CHECKPOINT_MAGIC, 1, 4, file) == 4;
+    ok = ok && fwrite(header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(metadata.data(), 1, metadata.size(), file) == metadata.size();
+    ok = ok && fwrite(pixels.data(), sizeof(float), pixels.size(), file) == pixels.size();
+    ok = fclose(file) == 0 && ok;
+    return ok && std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+bool readCheckpoint(const std::string &path, CheckpointInfo &info, uint &width, uint &height, std::vector<float> &pixels) {
+    TRACE_SCOPE("readCheckpoint");
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cout << "ERROR::CHECKPOINT::FILE_NOT_SUCCESSFULLY_OPENED: " << path << std::endl;
+        return false;
+    }
+    char magic[4];
+    uint32_t header[4];
+    bool ok = fread(magic, 1, 4, file) == 4 && std::memcmp(magic, CHECKPOINT_MAGIC, 4) == 0;
+    ok = ok && fread(header, sizeof(header), 1, file) == 1 && header[0] == CHECKPOINT_VERSION && header[3] == sizeof(CheckpointInfo);
+    ok = ok && fread(&info, sizeof(CheckpointInfo), 1, file) == 1;
+    if (ok) {
+        width = header[1];
+        height = header[2];
+        pixels.resize(4 * (size_t)width * height);
+        ok = fread(pixels.data(), sizeof(float), pixels.size(), file) == pixels.size();
+    }
+    fclose(file);
+    if (!ok) std::cout << "ERROR::CHECKPOINT::INVALID_FILE: " << path << std::endl;
+    return ok;
+}
+
+std::string checkpointMetadata(const CheckpointInfo &info) {
+    return std::string((const char*)&info, sizeof(CheckpointInfo));
+}
+
+static void hashBytes(uint64_t &hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+uint64_t hashScene(const Scene &scene, const std::vector<Triangle> &triangles, uint width, uint height) {
+    TRACE_SCOPE("hashScene");
+    uint64_t hash = 14695981039346656037ull;
+    hashBytes(hash, triangles.data(), triangles.size() * sizeof(Triangle));
+    hashBytes(hash, scene.models.data(), scene.models.size() * sizeof(SSBO_Model));
+    hashBytes(hash, scene.spheres.data(), scene.spheres.size() * sizeof(Sphere));
+    int settings[5] = {scene.maxBounces_reflection, scene.maxBounces_transmission, scene.samplesPerPixel, (int)width, (int)height};
+    hashBytes(hash, settings, sizeof(settings));
+    return hash;
+}
@@ -0,0 +1,33 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// Everything besides the accumulation texture that a render needs to continue exactly where it
+// stopped. frameIndex is the renderedFrames of the next frame, cpuFrameIndex the hybrid CPU's.
+struct CheckpointInfo {
+    uint64_t sceneHash;
+    uint frameIndex;
+    uint cpuFrameIndex;
+    vec3 cameraPosition;
+    float cameraPitch;
+    float cameraYaw;
+};
+
+// A .ckpt file is "RTCK", a version, the image size, a metadata block and the raw RGBA32F
+// accumulation (mean radiance, sample count in alpha), bottom row first. Written to a temporary
+// file and renamed, so a crash while writing leaves the previous checkpoint intact.
+bool writeCheckpointFile(const std::string &path, const std::string &metadata, uint width, uint height, const std::vector<float> &pixels);
+bool readCheckpoint(const std::string &path, CheckpointInfo &info, uint &width, uint &height, std::vector<float> &pixels);
+std::string checkpointMetadata(const CheckpointInfo &info);
+
+// FNV-1a over the uploaded geometry, materials and render settings
+uint64_t hashScene(const Scene &scene, const std::vector<Triangle> &triangles, uint width, uint height);
+
+#endif
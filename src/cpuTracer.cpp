@@ -0,0 +1,459 @@
+#include "cpuTracer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "trace.h"
+
+
+// the functions below mirror raytrace.frag one to one, keep them in sync
+static float RandomValue(uint &rngState) {
+    rngState = rngState * 747796405u + 2891336453u;
+    uint result = ((rngState >> ((rngState >> 28u) + 4u)) ^ rngState) * 277803737u;
+    result = (result >> 22u) ^ result;
+    return result / 4294967296.0f;
+}
+static float RandomValueNormalDistribution(uint &rngState) {
+    float theta = 2 * 3.1415926f * RandomValue(rngState);
+    float rho = sqrt(-2 * log(RandomValue(rngState)));
+    return rho * cos(theta);
+}
+static vec3 RandomDirection(uint &rngState) {
+    float x = RandomValueNormalDistribution(rngState);
+    float y = RandomValueNormalDistribution(rngState);
+    float z = RandomValueNormalDistribution(rngState);
+    return normalize(vec3(x, y, z));
+}
+static vec2 RandomDirectionInCircle(uint &rngState) {
+    float theta = RandomValue(rngState) * 3.1415926f * 2;
+    return vec2(cos(theta), sin(theta));
+}
+
+struct Ray {
+    vec3 origin;
+    vec3 dir;
+};
+struct HitMaterial {
+    vec3 color;
+    vec3 emissionColor;
+    float emissionStrength;
+    float roughness;
+    float transmission;
+    float ior;
+    float metalness;
+};
+struct HitInfo {
+    bool didHit;
+    float t;
+    vec3 pos;
+    vec3 normal;
+    HitMaterial material;
+    bool isBackFace;
+};
+
+static HitInfo intersectRaySphere(const Ray &ray, const Sphere &sphere, bool detectBackFace, float tMax) {
+    HitInfo hitInfo;
+    hitInfo.didHit = false;
+
+    vec3 offsetRayOrigin = ray.origin - vec3(sphere.pos_radius);
+    float a = dot(ray.dir, ray.dir);
+    float b = 2 * dot(offsetRayOrigin, ray.dir);
+    float c = dot(offsetRayOrigin, offsetRayOrigin) - sphere.pos_radius.w * sphere.pos_radius.w;
+    float discriminant = b * b - 4 * a * c;
+
+    if (discriminant > 0) {
+        float t = (-b - sqrt(discriminant)) / (2 * a);
+        if (t >= tMax) return hitInfo;
+        if (t <= 0 && detectBackFace) {
+            t = (-b + sqrt(discriminant)) / (2 * a);
+        }
+
+        if (t > 0 && t < tMax) {
+            hitInfo.didHit = true;
+            hitInfo.pos = ray.origin + ray.dir * t;
+            hitInfo.normal = normalize(hitInfo.pos - vec3(sphere.pos_radius));
+            hitInfo.isBackFace = dot(hitInfo.normal, ray.dir) > 0;
+            if (hitInfo.isBackFace) hitInfo.normal = -hitInfo.normal;
+            hitInfo.t = t;
+        }
+    }
+    return hitInfo;
+}
+
+static HitInfo intersectRayTriangle(const Ray &ray, const Triangle &triangle, bool detectBackFace) {
+    vec3 edgeAB = vec3(triangle.pos_uvx_B) - vec3(triangle.pos_uvx_A);
+    vec3 edgeAC = vec3(triangle.pos_uvx_C) - vec3(triangle.pos_uvx_A);
+    vec3 normalVector = cross(edgeAB, edgeAC);
+    vec3 ao = ray.origin - vec3(triangle.pos_uvx_A);
+    vec3 dao = cross(ao, ray.dir);
+
+    float determinant = -dot(ray.dir, normalVector);
+    float invDet = 1.0f / determinant;
+
+    float t = dot(ao, normalVector) * invDet;
+    float u = dot(edgeAC, dao) * invDet;
+    float v = -dot(edgeAB, dao) * invDet;
+    float w = 1.0f - u - v;
+
+    HitInfo hitInfo;
+    bool validDet = detectBackFace ? abs(determinant) >= 1e-6f : determinant >= 1e-6f;
+    hitInfo.didHit = validDet && t > 0 && u >= 0 && v >= 0 && w >= 0;
+    if (!hitInfo.didHit) return hitInfo;
+    hitInfo.pos = ray.origin + ray.dir * t;
+    hitInfo.normal = normalize(vec3(triangle.normal_uvy_A) * w + vec3(triangle.normal_uvy_B) * u + vec3(triangle.normal_uvy_C) * v) * (determinant < 0.0f ? -1.0f : 1.0f);
+    hitInfo.isBackFace = determinant < 0.0f;
+    hitInfo.t = t;
+    return hitInfo;
+}
+
+static float intersectRayBox(const Ray &ray, vec3 invDir, vec3 boxMin, vec3 boxMax) {
+    vec3 tMin = (boxMin - ray.origin) * invDir;
+    vec3 tMax = (boxMax - ray.origin) * invDir;
+    vec3 t1 = min(tMin, tMax);
+    vec3 t2 = max(tMin, tMax);
+    float tNear = max(max(t1.x, t1.y), t1.z);
+    float tFar = min(min(t2.x, t2.y), t2.z);
+    return tNear <= tFar && tFar > 0 ? tNear : std::numeric_limits<float>::infinity();
+}
+
+static float intersectRayNode(const Ray &ray, vec3 invDir, const BVHNode &node) {
+    return intersectRayBox(ray, invDir, node.boundMin, node.boundMax);
+}
+
+static HitMaterial unpackMaterial(vec4 color_roughness, vec4 emissionColor_emissionStrength, vec4 transmission_ior_metalness_tbd) {
+    HitMaterial material;
+    material.color = vec3(color_roughness);
+    material.emissionColor = vec3(emissionColor_emissionStrength);
+    material.emissionStrength = emissionColor_emissionStrength.a;
+    material.roughness = color_roughness.a;
+    material.transmission = transmission_ior_metalness_tbd.r;
+    material.ior = transmission_ior_metalness_tbd.g;
+    material.metalness = transmission_ior_metalness_tbd.b;
+    return material;
+}
+
+static Ray modelSpaceRay(const Ray &ray, const SSBO_Model &model) {
+    mat3 rotation = mat3(model.rotation);
+    return {rotation * (ray.origin - vec3(model.translation)), rotation * ray.dir};
+}
+
+static void traverseModel(const Ray &localRay, const SSBO_Model &model, bool detectBackFace, const std::vector<Triangle> &triangles, const std::vector<BVHNode> &nodes, HitInfo &closestHit) {
+    bool didHitModel = false;
+    vec3 invDir = 1.0f / localRay.dir;
+    uint stack[BVH_MAX_DEPTH];
+    float stackDist[BVH_MAX_DEPTH];
+    int stackSize = 0;
+    uint nodeIndex = model.nodeIndex;
+    while (true) {
+        const BVHNode &node = nodes[nodeIndex];
+        if (node.triangleCount > 0) {
+            for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                HitInfo hitInfo = intersectRayTriangle(localRay, triangles[i], detectBackFace);
+                if (hitInfo.didHit && hitInfo.t < closestHit.t) {
+                    didHitModel = true;
+                    closestHit = hitInfo;
+                    closestHit.material = unpackMaterial(model.color_roughness, model.emissionColor_emissionStrength, model.transmission_ior_metalness_tbd);
+                }
+            }
+        } else {
+            uint nearChild = node.leftFirst;
+            uint farChild = node.leftFirst + 1;
+            float nearDist = intersectRayNode(localRay, invDir, nodes[nearChild]);
+            float farDist = intersectRayNode(localRay, invDir, nodes[farChild]);
+            if (farDist < nearDist) {
+                std::swap(nearChild, farChild);
+                std::swap(nearDist, farDist);
+            }
+            if (nearDist < closestHit.t) {
+                if (farDist < closestHit.t) {
+                    stack[stackSize] = farChild;
+                    stackDist[stackSize++] = farDist;
+                }
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+        while (stackSize > 0 && stackDist[stackSize - 1] >= closestHit.t) stackSize--;
+        if (stackSize == 0) break;
+        nodeIndex = stack[--stackSize];
+    }
+    if (didHitModel) {
+        closestHit.pos = mat3(model.inverseRotation) * closestHit.pos + vec3(model.translation);
+        closestHit.normal = normalize(transpose(mat3(model.rotation)) * closestHit.normal);
+    }
+}
+
+static HitInfo calculateRayIntersection(const Ray &ray, bool detectBackFace, const std::vector<Sphere> &spheres, const std::vector<Triangle> &triangles, const std::vector<BVHNode> &nodes, const std::vector<SSBO_Model> &models) {
+    HitInfo closestHit;
+    closestHit.didHit = false;
+    closestHit.t = std::numeric_limits<float>::infinity();
+
+    for (const Sphere &sphere : spheres) {
+        HitInfo hitInfo = intersectRaySphere(ray, sphere, detectBackFace, closestHit.t);
+        if (hitInfo.didHit && hitInfo.t < closestHit.t) {
+            closestHit = hitInfo;
+            closestHit.material = unpackMaterial(sphere.color_roughness, sphere.emissionColor_emissionStrength, sphere.transmission_ior_metalness_tbd);
+        }
+    }
+    // the spheres already bound closestHit.t, boxes that start behind it are skipped whole
+    for (const SSBO_Model &model : models) {
+        Ray localRay = modelSpaceRay(ray, model);
+        if (intersectRayBox(localRay, 1.0f / localRay.dir, vec3(model.boundMin), vec3(model.boundMax)) >= closestHit.t) continue;
+        traverseModel(localRay, model, detectBackFace, triangles, nodes, closestHit);
+    }
+    return closestHit;
+}
+
+// same any-hit query as occluded() in raytrace.frag
+static bool occludedByModel(const Ray &ray, const SSBO_Model &model, float tMax, const std::vector<Triangle> &triangles, const std::vector<BVHNode> &nodes) {
+    Ray localRay = modelSpaceRay(ray, model);
+    vec3 invDir = 1.0f / localRay.dir;
+    if (intersectRayBox(localRay, invDir, vec3(model.boundMin), vec3(model.boundMax)) >= tMax) return false;
+
+    uint stack[BVH_MAX_DEPTH];
+    int stackSize = 0;
+    uint nodeIndex = model.nodeIndex;
+    while (true) {
+        const BVHNode &node = nodes[nodeIndex];
+        if (node.triangleCount > 0) {
+            for (uint i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                HitInfo hitInfo = intersectRayTriangle(localRay, triangles[i], true);
+                if (hitInfo.didHit && hitInfo.t < tMax) return true;
+            }
+        } else {
+            bool hitLeft = intersectRayNode(localRay, invDir, nodes[node.leftFirst]) < tMax;
+            bool hitRight = intersectRayNode(localRay, invDir, nodes[node.leftFirst + 1]) < tMax;
+            if (hitLeft && hitRight) stack[stackSize++] = node.leftFirst + 1;
+            if (hitLeft || hitRight) {
+                nodeIndex = hitLeft ? node.leftFirst : node.leftFirst + 1;
+                continue;
+            }
+        }
+        if (stackSize == 0) return false;
+        nodeIndex = stack[--stackSize];
+    }
+}
+
+static bool occluded(const Ray &ray, float tMax, const std::vector<Sphere> &spheres, const std::vector<Triangle> &triangles, const std::vector<BVHNode> &nodes, const std::vector<SSBO_Model> &models) {
+    for (const Sphere &sphere : spheres)
+        if (intersectRaySphere(ray, sphere, true, tMax).didHit) return true;
+    for (const SSBO_Model &model : models)
+        if (occludedByModel(ray, model, tMax, triangles, nodes)) return true;
+    return false;
+}
+
+static float fresnelReflection(vec3 wi, vec3 normal, float iorI, float iorT) {
+    float refractRatio = iorI / iorT;
+    float cosAngleIn = -dot(wi, normal);
+    float sinSqrAngleOfRefraction = refractRatio * refractRatio * (1 - cosAngleIn * cosAngleIn);
+    if (sinSqrAngleOfRefraction >= 1) return 1; // Ray is fully reflected, no refraction occurs
+
+    float cosAngleOfRefraction = sqrt(1 - sinSqrAngleOfRefraction);
+    float denominatorPerpendicular = iorI * cosAngleIn + iorT * cosAngleOfRefraction;
+    float denominatorParallel = iorI * cosAngleIn + iorT * cosAngleOfRefraction;
+
+    if (min(denominatorPerpendicular, denominatorParallel) < 1E-8f) return 1;
+
+    float rPerpendicular = (iorI * cosAngleIn - iorT * cosAngleOfRefraction) / denominatorPerpendicular;
+    rPerpendicular *= rPerpendicular;
+    float rParallel = (iorT * cosAngleIn - iorI * cosAngleOfRefraction) / denominatorParallel;
+    rParallel *= rParallel;
+
+    return (rPerpendicular + rParallel) / 2;
+}
+
+static void frisvad(const vec3 n, vec3 &b1, vec3 &b2) {
+    if (n.z < -0.9999999f) {
+        b1 = vec3(0.0f, -1.0f, 0.0f);
+        b2 = vec3(-1.0f, 0.0f, 0.0f);
+        return;
+    }
+    const float a = 1.0f / (1.0f + n.z);
+    const float b = -n.x * n.y * a;
+    b1 = vec3(1.0f - n.x * n.x * a, b, -n.x);
+    b2 = vec3(b, 1.0f - n.y * n.y * a, -n.y);
+}
+
+static vec3 SampleVndf_Hemisphere(vec2 u, vec3 wi) {
+    float phi = 2.0f * 3.1415926f * u.x;
+    float z = fma((1.0f - u.y), (1.0f + wi.z), -wi.z);
+    float sinTheta = sqrt(clamp(1.0f - z * z, 0.0f, 1.0f));
+    float x = sinTheta * cos(phi);
+    float y = sinTheta * sin(phi);
+    return vec3(x, y, z) + wi;
+}
+
+static vec3 SampleVndf_GGX(vec2 u, vec3 wi, vec2 alpha) {
+    vec3 wiStd = normalize(vec3(vec2(wi) * alpha, wi.z));
+    vec3 wmStd = SampleVndf_Hemisphere(u, wiStd);
+    return normalize(vec3(vec2(wmStd) * alpha, wmStd.z));
+}
+
+static vec3 sampleGGXnormal(vec3 N, vec3 world_wi, vec2 u, vec2 alpha) {
+    vec3 T, B;
+    frisvad(N, T, B);
+    vec3 local_wi = normalize(vec3(dot(world_wi, T), dot(world_wi, B), dot(world_wi, N)));
+    vec3 local_m = SampleVndf_GGX(u, local_wi, alpha);
+    return normalize(local_m.x * T + local_m.y * B + local_m.z * N);
+}
+
+static vec3 GetEnvironmentLight(const Ray &) {
+    return vec3(1.0);
+}
+
+
+CpuTracer::CpuTracer() {
+    rowStart = 0;
+    samplesPerPixel = 0;
+    batchSeconds = 0.0;
+    frameIndex = 0;
+    maxBounces_reflection = 0;
+    maxBounces_transmission = 0;
+    // leave one core for the render thread
+    threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    busy = false;
+    cancelled = false;
+    resultReady = false;
+}
+CpuTracer::~CpuTracer() {
+    cancel();
+}
+
+void CpuTracer::setScene(const std::vector<Sphere> &spheres_, const std::vector<Triangle> &triangles_, const std::vector<BVHNode> &nodes_, const std::vector<SSBO_Model> &models_) {
+    cancel();
+    spheres = spheres_;
+    triangles = triangles_;
+    nodes = nodes_;
+    models = models_;
+}
+
+bool CpuTracer::occluded(vec3 origin, vec3 dir, float tMax) const {
+    return ::occluded({origin, dir}, tMax, spheres, triangles, nodes, models);
+}
+
+void CpuTracer::start(const Camera &camera_, uint rowStart_, uint frameIndex_, uint samplesPerPixel_, int maxBounces_reflection_, int maxBounces_transmission_) {
+    cancel();
+    camera = camera_;
+    rowStart = min(rowStart_, camera.resolution.y);
+    frameIndex = frameIndex_;
+    samplesPerPixel = samplesPerPixel_;
+    maxBounces_reflection = maxBounces_reflection_;
+    maxBounces_transmission = maxBounces_transmission_;
+    samples.assign((camera.resolution.y - rowStart) * camera.resolution.x, vec4(0.0));
+    busy = true;
+    batchThread = std::thread(&CpuTracer::run, this);
+}
+
+// stops the running batch and throws its samples away
+void CpuTracer::cancel() {
+    cancelled = true;
+    if (batchThread.joinable()) batchThread.join();
+    cancelled = false;
+    busy = false;
+    resultReady = false;
+}
+
+bool CpuTracer::isBusy() const {
+    return busy;
+}
+bool CpuTracer::hasResult() const {
+    return !busy && resultReady;
+}
+void CpuTracer::consumeResult() {
+    if (batchThread.joinable()) batchThread.join();
+    resultReady = false;
+}
+
+void CpuTracer::run() {
+    TRACE_SCOPE("cpu batch");
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // interleave rows between workers so the expensive parts of the band are shared evenly
+    std::vector<std::thread> workers;
+    for (uint i = 1; i < threadCount; i++)
+        workers.emplace_back(&CpuTracer::renderRows, this, i, threadCount);
+    renderRows(0, threadCount);
+    for (std::thread &worker : workers)
+        worker.join();
+
+    batchSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    resultReady = !cancelled;
+    busy = false;
+}
+
+void CpuTracer::renderRows(uint firstRow, uint rowStep) {
+    TRACE_SCOPE("cpu rows");
+    vec2 resolution = vec2(camera.resolution);
+    mat3 cameraBasis = mat3(camera.right, camera.up, camera.forward);
+    // same as cameraRayDir in raytrace.frag: the ray directions at the quad corners, interpolated
+    vec3 dirBL = cameraBasis * normalize(vec3(resolution * vec2(0, 0) - resolution * .5f, camera.focalLength));
+    vec3 dirBR = cameraBasis * normalize(vec3(resolution * vec2(1, 0) - resolution * .5f, camera.focalLength));
+    vec3 dirTL = cameraBasis * normalize(vec3(resolution * vec2(0, 1) - resolution * .5f, camera.focalLength));
+    vec3 dirTR = cameraBasis * normalize(vec3(resolution * vec2(1, 1) - resolution * .5f, camera.focalLength));
+
+    for (uint y = rowStart + firstRow; y < camera.resolution.y; y += rowStep) {
+        if (cancelled) return;
+        for (uint x = 0; x < camera.resolution.x; x++) {
+            vec2 uv = (vec2(x, y) + 0.5f) / resolution;
+            vec3 rayDir = uv.x + uv.y >= 1.0f
+                ? dirBR * (1.0f - uv.y) + dirTL * (1.0f - uv.x) + dirTR * (uv.x + uv.y - 1.0f)
+                : dirBL * (1.0f - uv.x - uv.y) + dirBR * uv.x + dirTL * uv.y;
+
+            vec3 radiance = vec3(0.0);
+            for (uint sample = 0; sample < samplesPerPixel; sample++) {
+                uint rngState = x * camera.resolution.x + y + (frameIndex + sample) * 719393u;
+                vec2 jitter = RandomDirectionInCircle(rngState) / resolution.x;
+                Ray ray = {camera.position, vec3(vec2(rayDir) + jitter, rayDir.z)};
+
+                vec3 inLight = vec3(0.0);
+                vec3 rayColor = vec3(1.0);
+                int reflectionBounces = 0;
+                int transmissionBounces = 0;
+                bool isInsideMedium = false;
+                while (reflectionBounces < maxBounces_reflection && transmissionBounces < maxBounces_transmission) {
+                    HitInfo hitInfo = calculateRayIntersection(ray, isInsideMedium, spheres, triangles, nodes, models);
+                    if (!hitInfo.didHit) {
+                        inLight += GetEnvironmentLight(ray) * rayColor;
+                        break;
+                    }
+                    HitMaterial material = hitInfo.material;
+
+                    vec3 microsurfaceNormal = sampleGGXnormal(hitInfo.normal, -ray.dir, vec2(RandomValue(rngState), RandomValue(rngState)), vec2(material.roughness));
+                    if (material.roughness < 0.01f) microsurfaceNormal = hitInfo.normal;
+
+                    vec3 diffuseDir = normalize(hitInfo.normal + RandomDirection(rngState));
+                    vec3 specularReflectionDir = reflect(ray.dir, microsurfaceNormal);
+                    vec3 specularTransmissionDir = refract(ray.dir, microsurfaceNormal, isInsideMedium ? material.ior : 1.0f / material.ior);
+
+                    inLight += material.emissionColor * material.emissionStrength * rayColor;
+
+                    if (RandomValue(rngState) < material.metalness) {
+                        if (dot(specularReflectionDir, hitInfo.normal) < 0.0f) break;
+                        ray.dir = specularReflectionDir;
+                        rayColor *= material.color;
+                        reflectionBounces++;
+                    } else if (RandomValue(rngState) < fresnelReflection(ray.dir, microsurfaceNormal, isInsideMedium ? material.ior : 1.0f, isInsideMedium ? 1.0f : material.ior)) {
+                        if (dot(specularReflectionDir, hitInfo.normal) < 0.0f) break;
+                        ray.dir = specularReflectionDir;
+                        reflectionBounces++;
+                    } else if (RandomValue(rngState) < material.transmission) {
+                        ray.dir = specularTransmissionDir;
+                        transmissionBounces++;
+                        isInsideMedium = !isInsideMedium;
+                        rayColor *= material.color;
+                    } else {
+                        ray.dir = diffuseDir;
+                        rayColor *= material.color;
+                        reflectionBounces++;
+                    }
+
+                    ray.origin = hitInfo.pos + ray.dir * 1e-6f;
+                }
+                radiance += inLight;
+            }
+            samples[(y - rowStart) * camera.resolution.x + x] = vec4(radiance, samplesPerPixel);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef CPUTRACER_H
+#define CPUTRACER_H
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "model.h"
+#include "objParser.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// CPU port of raytrace.frag. Renders the rows [rowStart, resolution.y) on worker threads
+// while the GPU traces the rest of the image; see the hybrid mode in main.cpp.
+class CpuTracer {
+    public:
+        CpuTracer();
+        ~CpuTracer();
+
+        void setScene(const std::vector<Sphere> &spheres_, const std::vector<Triangle> &triangles_, const std::vector<BVHNode> &nodes_, const std::vector<SSBO_Model> &models_);
+        void start(const Camera &camera_, uint rowStart_, uint frameIndex_, uint samplesPerPixel_, int maxBounces_reflection_, int maxBounces_transmission_);
+        void cancel();
+        bool isBusy() const;
+        bool hasResult() const;
+        void consumeResult();
+        // any-hit visibility query against the scene of setScene, true if something lies before tMax
+        bool occluded(vec3 origin, vec3 dir, float tMax) const;
+
+        // radiance sum in rgb and sample count in a, one texel per pixel of the band
+        std::vector<vec4> samples;
+        uint rowStart;
+        uint samplesPerPixel;
+        double batchSeconds;
+
+    private:
+        void run();
+        void renderRows(uint firstRow, uint rowStep);
+
+        std::vector<Sphere> spheres;
+        std::vector<Triangle> triangles;
+        std::vector<BVHNode> nodes;
+        std::vector<SSBO_Model> models;
+
+        Camera camera;
+        uint frameIndex;
+        int maxBounces_reflection;
+        int maxBounces_transmission;
+        unsigned int threadCount;
+
+        std::thread batchThread;
+        std::atomic<bool> busy;
+        std::atomic<bool> cancelled;
+        bool resultReady;
+};
+
+#endif
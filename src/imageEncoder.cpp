@@ -0,0 +1,189 @@
+#include "imageEncoder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+
+#include "batch.h"
+#include "checkpoint.h"
+#include "trace.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+
+// same transfer as display.frag, rows stay bottom first
+static std::vector<unsigned char> tonemap(const EncodeJob &job) {
+    std::vector<unsigned char> rgb(3 * (size_t)job.width * job.height);
+    for (size_t i = 0; i < (size_t)job.width * job.height; i++)
+        for (int c = 0; c < 3; c++)
+            rgb[3 * i + c] = (unsigned char)(std::clamp(std::pow(job.pixels[4 * i + c], 1.0f / 2.2f), 0.0f, 1.0f) * 255.0f + 0.5f);
+    return rgb;
+}
+
+static bool writePNG(const EncodeJob &job, const std::string &path) {
+    std::vector<unsigned char> rgb = tonemap(job);
+    return stbi_write_png(path.c_str(), job.width, job.height, 3, rgb.data(), 3 * job.width);
+}
+
+// "Quite OK Image" format, lossless and many times faster to encode than PNG, see qoiformat.org
+static bool writeQOI(const EncodeJob &job, const std::string &path) {
+    std::vector<unsigned char> rgb = tonemap(job);
+    std::vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+    out.reserve(14 + 4 * rgb.size() / 3 + 8);
+    for (uint value : {job.width, job.height})
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((value >> shift) & 0xff);
+    out.push_back(3); // channels
+    out.push_back(0); // sRGB with linear alpha
+
+    // RGBA like a decoder keeps them, every pixel written is opaque but the index starts transparent
+    unsigned char index[64][4] = {};
+    unsigned char previous[4] = {0, 0, 0, 255};
+    int run = 0;
+    size_t pixelCount = (size_t)job.width * job.height;
+    size_t written = 0;
+    // QOI stores the top row first
+    for (uint row = job.height; row-- > 0;) {
+        for (uint x = 0; x < job.width; x++) {
+            const unsigned char* rgbPixel = &rgb[3 * ((size_t)row * job.width + x)];
+            unsigned char pixel[4] = {rgbPixel[0], rgbPixel[1], rgbPixel[2], 255};
+            written++;
+            if (std::equal(pixel, pixel + 4, previous)) {
+                run++;
+                if (run == 62 || written == pixelCount) {
+                    out.push_back(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+            if (std::equal(pixel, pixel + 4, index[hash])) {
+                out.push_back(hash);
+            } else {
+                std::copy(pixel, pixel + 4, index[hash]);
+                int8_t dr = pixel[0] - previous[0];
+                int8_t dg = pixel[1] - previous[1];
+                int8_t db = pixel[2] - previous[2];
+                int8_t drdg = dr - dg;
+                int8_t dbdg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7) {
+                    out.push_back(0x80 | (dg + 32));
+                    out.push_back((drdg + 8) << 4 | (dbdg + 8));
+                } else {
+                    out.insert(out.end(), {0xfe, pixel[0], pixel[1], pixel[2]});
+                }
+            }
+            std::copy(pixel, pixel + 4, previous);
+        }
+    }
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    return fclose(file) == 0 && ok;
+}
+
+// portable float map: linear RGB floats, bottom row first like GL, negative scale = little endian
+static bool writePFM(const EncodeJob &job, const std::string &path) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "PF\n%u %u\n-1.0\n", job.width, job.height);
+    std::vector<float> rgb(3 * (size_t)job.width);
+    bool ok = true;
+    for (uint row = 0; row < job.height; row++) {
+        for (uint x = 0; x < job.width; x++)
+            for (int c = 0; c < 3; c++)
+                rgb[3 * x + c] = job.pixels[4 * ((size_t)row * job.width + x) + c];
+        ok = ok && fwrite(rgb.data(), sizeof(float), rgb.size(), file) == rgb.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+static bool hasExtension(const std::string &path, const char* extension) {
+    size_t length = std::char_traits<char>::length(extension);
+    return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+ImageEncoder::ImageEncoder(unsigned int threadCount, int pngCompression) {
+    active = 0;
+    stopping = false;
+    // GL hands rows over bottom first
+    stbi_flip_vertically_on_write(1);
+    stbi_write_png_compression_level = std::clamp(pngCompression, 0, 9);
+    for (unsigned int i = 0; i < std::max(1u, threadCount); i++)
+        workers.emplace_back(&ImageEncoder::work, this);
+}
+ImageEncoder::~ImageEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ImageEncoder::submit(EncodeJob &&job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingPaths.insert(job.path);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+bool ImageEncoder::isPending(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pendingPaths.count(path) > 0;
+}
+
+// blocks until every submitted image is written
+void ImageEncoder::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return jobs.empty() && active == 0; });
+}
+
+void ImageEncoder::work() {
+    while (true) {
+        EncodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            active++;
+        }
+
+        {
+            TRACE_SCOPE("encode");
+            bool ok;
+            // checkpoints and batches go through a temporary file on their own
+            std::string temporaryPath = job.path + ".tmp";
+            if (hasExtension(job.path, ".ckpt")) ok = writeCheckpointFile(job.path, job.metadata, job.width, job.height, job.pixels);
+            else if (hasExtension(job.path, ".rtsb")) ok = writeBatchFile(job.path, job.metadata, job.width, job.height, job.pixels);
+            else {
+                if (hasExtension(job.path, ".pfm")) ok = writePFM(job, temporaryPath);
+                else if (hasExtension(job.path, ".qoi")) ok = writeQOI(job, temporaryPath);
+                else ok = writePNG(job, temporaryPath);
+                ok = ok && std::rename(temporaryPath.c_str(), job.path.c_str()) == 0;
+            }
+            if (!ok) std::cout << "ERROR::ENCODER::WRITE_FAILED: " << job.path << std::endl;
+            if (job.onWritten) job.onWritten(ok);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingPaths.erase(pendingPaths.find(job.path));
+            active--;
+        }
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef IMAGEENCODER_H
+#define IMAGEENCODER_H
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// Linear radiance straight from the accumulation texture, RGBA with the bottom row first like GL
+// returns it. The format follows the extension of `path`: .png and .qoi are tonemapped to 8 bit
+// like the display pass, .pfm keeps the float radiance for compositing, .ckpt writes a
+// checkpoint (see checkpoint.h) and .rtsb a sample batch (see batch.h) with `metadata` in its header.
+struct EncodeJob {
+    std::string path;
+    uint width, height;
+    std::vector<float> pixels;
+    std::string metadata;
+    // optional, called on the encoder thread once the file is in place or failed to write
+    std::function<void(bool written)> onWritten = nullptr;
+};
+
+// Writes images on worker threads so the render thread only pays for handing the pixels over.
+// pngCompression is the zlib level, 0-9; the low levels are much faster and barely bigger.
+// Every file is written under a temporary name and renamed, readers never see half an image.
+class ImageEncoder {
+    public:
+        ImageEncoder(unsigned int threadCount = 2, int pngCompression = 2);
+        // finishes every queued job first
+        ~ImageEncoder();
+
+        void submit(EncodeJob &&job);
+        void wait();
+        // whether a job for `path` is queued or being written
+        bool isPending(const std::string &path);
+
+    private:
+        void work();
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::deque<EncodeJob> jobs;
+        std::multiset<std::string> pendingPaths;
+        unsigned int active;
+        bool stopping;
+};
+
+#endif
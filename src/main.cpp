@@ -1,6 +1,11 @@
 #include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "objParser.h"
@@ -9,19 +14,30 @@
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
 #include "glm/ext/matrix_transform.hpp"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <algorithm>
 
+#include "batch.h"
+#include "checkpoint.h"
+#include "cpuTracer.h"
+#include "imageEncoder.h"
 #include "model.h"
-#include "stb_image_write.h"
+#include "readback.h"
+#include "renderDaemon.h"
+#include "renderer.h"
+#include "scene.h"
+#include "tileRender.h"
+#include "timers.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <unistd.h>
+#endif
 
 using namespace glm;
 
-void sendSpheres();
-void sendTriangles();
-void sendModels();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void saveScreenshot(int x, int y, int width, int height, char name[]);
+void saveScreenshot(const std::string &name);
 void processInput(GLFWwindow *window);
 float deltaTime = 0.0f;
 unsigned int frameCount = 0;
@@ -33,6 +49,13 @@ float cameraPitch = 0, cameraYaw = 180;
 
 bool START_RENDER = false;
 bool ZERO_TOGGLE = true;
+bool HYBRID_RENDER = false;
+
+// traversal cost heatmap or ambient occlusion, cycled with V; for the latter the value is the occlusion distance
+const char* debugModeNames[] = {"off", "node visits", "triangle tests", "bounces", "ambient occlusion"};
+const float debugHeatmapMax[] = {0, 64, 4096, 10, 0.5};
+auto lastRayStatsReport = std::chrono::high_resolution_clock::now();
+void reportRayStats();
 
 // #define FULLSCREEN
 #ifdef FULLSCREEN
@@ -43,9 +66,47 @@ const unsigned int SCR_WIDTH = 1920 / 4;
 const unsigned int SCR_HEIGHT = 1080 / 4;
 #endif
 
-GLuint sphereSSBO;
-GLuint triangleSSBO;
-GLuint modelSSBO;
+Renderer* renderer;
+
+// screenshots are read back and written in the background, see saveScreenshot
+ImageEncoder* encoder;
+FrameReadback* readback;
+std::string imageFormat = "png";
+
+// per-pass timings, shown in the window title
+GpuTimer* raytraceTimer;
+GpuTimer* displayTimer;
+RollingStats inputStats, hybridStats, swapStats, frameStats;
+auto lastTitleUpdate = std::chrono::high_resolution_clock::now();
+void updateWindowTitle(GLFWwindow* window);
+// set by --trace, T writes the trace there or to trace.json
+std::string tracePath;
+
+Scene scene;
+// set while the meshes of an interactively rendered scene are still loading, see updateSceneStream
+SceneStream* sceneStream = nullptr;
+void updateSceneStream();
+
+// hybrid rendering: the CPU traces the rows at or above renderer->cpuRowStart and the GPU the rest
+CpuTracer cpuTracer;
+uint cpuFrameIndex = 0;
+double gpuPixelSamplesPerSecond = 0.0;
+uint64_t raytraceTimingsSeen = 0;
+double cpuPixelSamplesPerSecond = 0.0;
+void updateHybridRender();
+Camera getCamera();
+void updateCameraAxes();
+int renderCameraPath(GLFWwindow* window, uint frames, uint samples);
+int renderBatch(uint firstFrame, uint samples, const std::string &path);
+int runTileWorker(const std::string &scenePath);
+
+// long renders write their accumulation every checkpointInterval seconds and can be resumed from it
+std::string checkpointPath;
+double checkpointInterval = 60.0;
+uint64_t sceneHash = 0;
+auto lastCheckpoint = std::chrono::high_resolution_clock::now();
+void writeCheckpoint(uint nextFrame);
+bool resumeCheckpoint(const std::string &path);
 
 // vec3 cameraPosition = vec3(0.332639, 0.912504, 1.23726);
 vec3 cameraPosition = vec3(0, 0, 4);
@@ -53,15 +114,116 @@ vec3 cameraForward = vec3(0, 0, 1);
 vec3 cameraUp = vec3(0, 1, 0);
 vec3 cameraRight = vec3(1, 0, 0);
 
-int main() {
-    stbi_flip_vertically_on_write(1);
+int main(int argc, char* argv[]) {
+    // the scene is the first plain argument, or the default one
+    // --render-path <frames> <spp>: render the scene's camera path to SCREENSHOTS_PATH and quit
+    // --format <png|qoi|pfm>: screenshot and frame format, pfm keeps the float radiance
+    // --png-compression <0-9>
+    // --checkpoint <file.ckpt>: periodically save the accumulation, --checkpoint-interval <seconds>
+    // --resume <file.ckpt>: continue a checkpointed render of the same scene
+    // --batch-samples <spp> [--batch-offset <frame>] [--batch-output <file.rtsb>]: render one batch of a
+    //     distributed render and quit, node k of n uses offset k * spp / samplesPerPixel, see raytracer_merge
+    // --render-tiles <width> <height> <spp>: render the image in tiles on worker processes and quit, with
+    //     --workers <n>, --tile-size <pixels>, --tile-timeout <seconds> and --worker-command <shell command>
+    //     for workers elsewhere, e.g. "ssh node2 raytracer --tile-worker scene", see tileRender.h
+    // --tile-worker: serve tiles on stdin/stdout, started by --render-tiles
+    // --daemon <socket>: keep scenes and shaders loaded and render jobs sent to a Unix socket, see renderDaemon.h
+    // --trace <file.json>: write a Chrome trace of the CPU scopes and GPU passes on exit, see trace.h
+    // ------------------------------------------------
+    std::string scenePath = RESOURCES_PATH "default.scene";
+    std::string resumePath;
+    uint batchOffset = 0, batchSamples = 0;
+    std::string batchPath;
+    TileRenderSettings tileSettings;
+    tileSettings.setup = {0, 0, 256, 0};
+    std::string workerCommand;
+    bool tileWorker = false;
+    std::string daemonSocket;
+    uint pathFrames = 0, pathSamples = 0;
+    int pngCompression = 2;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--render-path" && i + 2 < argc) {
+            pathFrames = std::stoi(argv[++i]);
+            pathSamples = std::stoi(argv[++i]);
+        } else if (arg == "--format" && i + 1 < argc) {
+            imageFormat = argv[++i];
+        } else if (arg == "--png-compression" && i + 1 < argc) {
+            pngCompression = std::stoi(argv[++i]);
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpointInterval = std::stod(argv[++i]);
+        } else if (arg == "--resume" && i + 1 < argc) {
+            resumePath = argv[++i];
+        } else if (arg == "--batch-offset" && i + 1 < argc) {
+            batchOffset = std::stoi(argv[++i]);
+        } else if (arg == "--batch-samples" && i + 1 < argc) {
+            batchSamples = std::stoi(argv[++i]);
+        } else if (arg == "--batch-output" && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (arg == "--render-tiles" && i + 3 < argc) {
+            tileSettings.setup.imageWidth = std::stoi(argv[++i]);
+            tileSettings.setup.imageHeight = std::stoi(argv[++i]);
+            tileSettings.setup.samples = std::stoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            tileSettings.workerCount = std::stoi(argv[++i]);
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            tileSettings.setup.tileSize = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--tile-timeout" && i + 1 < argc) {
+            tileSettings.tileTimeout = std::stod(argv[++i]);
+        } else if (arg == "--worker-command" && i + 1 < argc) {
+            workerCommand = argv[++i];
+        } else if (arg == "--tile-worker") {
+            tileWorker = true;
+        } else if (arg == "--daemon" && i + 1 < argc) {
+            daemonSocket = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else {
+            scenePath = arg;
+        }
+    }
+
+    // the coordinator only moves pixels, it needs neither a window nor the scene
+    if (tileSettings.setup.imageWidth > 0 && tileSettings.setup.imageHeight > 0) {
+        if (workerCommand.empty()) tileSettings.workerCommand = {argv[0], "--tile-worker", scenePath};
+        else tileSettings.workerCommand = {"/bin/sh", "-c", workerCommand};
+        std::filesystem::create_directories(SCREENSHOTS_PATH);
+        tileSettings.outputPath = SCREENSHOTS_PATH "tiles." + imageFormat;
+        int result = runTileCoordinator(tileSettings);
+        if (!tracePath.empty()) traceWrite(tracePath);
+        return result;
+    }
 
     // glfw: initialize and configure
     // ------------------------------
-    glfwInit();
+    traceThreadId(); // the main thread is tid 0 in the trace
+    // the scene is parsed and its BVHs are built on other threads while GLFW, the window and the
+    // display shader start up. The window starts rendering with whatever meshes are done by then,
+    // the other modes need all of them for their first sample.
+    std::future<bool> sceneLoaded;
+    if (!tileWorker && daemonSocket.empty()) {
+        if (pathFrames == 0 && batchSamples == 0 && resumePath.empty()) {
+            sceneStream = new SceneStream();
+            if (!sceneStream->start(scenePath, scene)) {
+                delete sceneStream;
+                return -1;
+            }
+        } else {
+            // renders nobody watches fail on a bad line rather than quietly miss part of the scene
+            bool strict = pathFrames > 0 || batchSamples > 0;
+            sceneLoaded = std::async(std::launch::async, [&scenePath, strict] { return loadScene(scenePath, scene) && (!strict || scene.errorCount == 0); });
+        }
+    }
+    {
+        TRACE_SCOPE("glfwInit");
+        glfwInit();
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (tileWorker || !daemonSocket.empty()) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -69,12 +231,16 @@ int main() {
 
     // glfw window creation
     // --------------------
+    GLFWwindow* window;
+    {
+        TRACE_SCOPE("glfwCreateWindow");
 #ifdef FULLSCREEN
-    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", monitor, NULL);
+        GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", monitor, NULL);
 #else
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
 #endif
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -91,85 +257,92 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // let the driver compile on its own threads, Shader then only waits in its first use()
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+        auto maxShaderCompilerThreads = (void (*)(GLuint))glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxShaderCompilerThreads) {
+            maxShaderCompilerThreads(0xFFFFFFFFu);
+            Shader::parallelCompile = true;
+        }
+    }
 
 
-    // set up vertex data (and buffer(s)) and configure vertex attributes
-    // ------------------------------------------------------------------
-    float vertices[] = {
-         1.0f,  1.0f, 0.0f,  1.0, 1.0,  // top right
-         1.0f, -1.0f, 0.0f,  1.0, 0.0,  // bottom right
-        -1.0f, -1.0f, 0.0f,  0.0, 0.0,  // bottom left
-        -1.0f,  1.0f, 0.0f,  0.0, 1.0   // top left
-    };
-    unsigned int indices[] = {  // note that we start from 0!
-        0, 1, 3,  // first Triangle
-        1, 2, 3   // second Triangle
-    };
-    unsigned int VBO, VAO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3*sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    // remember: do NOT unbind the EBO while a VAO is active as the bound element buffer object IS stored in the VAO; keep the EBO bound.
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens. Modifying other
-    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
-    glBindVertexArray(0);
-
-    // Create 2 textures for ping-pong accumulation
-    GLuint accumTextures[2];
-    glGenTextures(2, accumTextures);
-    for (int i = 0; i < 2; ++i) {
-        glBindTexture(GL_TEXTURE_2D, accumTextures[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    }
-
-    // Framebuffer for rendering accumulation
-    GLuint fbo;
-    glGenFramebuffers(1, &fbo);
-
-
-    Shader shader(RESOURCES_PATH "/default.vert", RESOURCES_PATH "/raytrace.frag");
-    Shader displayShader(RESOURCES_PATH "/default.vert", RESOURCES_PATH "/display.frag");
-
-    glGenBuffers(1, &sphereSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sphereSSBO);
-    sendSpheres();
-
-    glGenBuffers(1, &modelSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelSSBO);
-    sendModels();
-
-    glGenBuffers(1, &triangleSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
-    // std::vector<Triangle> trianglesFromModel = getTrianglesFromOBJ(RESOURCES_PATH "/box.obj");
-    // for (Triangle triangle : trianglesFromModel) {
-        // triangles.push_back(triangle);
-    // }
-    // trianglesFromModel = getTrianglesFromOBJ(RESOURCES_PATH "/sphere_3.obj");
-    // for (Triangle triangle : trianglesFromModel) {
-        // triangles.push_back(triangle);
-    // }
-    sendTriangles();
+    if (tileWorker) {
+        int result = runTileWorker(scenePath);
+        glfwTerminate();
+        return result;
+    }
+    if (!daemonSocket.empty()) {
+        bool served;
+        {
+            RenderDaemon daemon(daemonSocket);
+            served = daemon.run();
+        }
+        if (!tracePath.empty()) traceWrite(tracePath);
+        glfwTerminate();
+        return served ? 0 : -1;
+    }
+
+    {
+        TRACE_SCOPE("Renderer");
+        renderer = new Renderer(SCR_WIDTH, SCR_HEIGHT);
+    }
+    encoder = new ImageEncoder(std::max(1u, std::thread::hardware_concurrency() / 2), pngCompression);
+    readback = new FrameReadback(SCR_WIDTH, SCR_HEIGHT, *encoder);
+
+    bool loaded = true;
+    if (sceneLoaded.valid()) {
+        TRACE_SCOPE("wait for scene");
+        loaded = sceneLoaded.get();
+    } else {
+        sceneStream->poll(scene);
+    }
+    if (!loaded)
+    {
+        delete readback;
+        delete encoder;
+        delete renderer;
+        glfwTerminate();
+        return -1;
+    }
+    cameraPosition = scene.cameraPosition;
+    cameraPitch = scene.cameraPitch;
+    cameraYaw = scene.cameraYaw;
+    renderer->maxBounces_reflection = scene.maxBounces_reflection;
+    renderer->maxBounces_transmission = scene.maxBounces_transmission;
+    renderer->samplesPerPixel = scene.samplesPerPixel;
+
+    renderer->sendSpheres(scene.spheres);
+    renderer->sendModels(scene.models);
+    // the variant only depends on the instances, it compiles while the meshes upload
+    renderer->prepareShader();
+    renderer->sendTriangles(triangles);
+    renderer->sendBVHNodes(bvhNodes);
+
+    if (!sceneStream) {
+        TRACE_SCOPE("CpuTracer::setScene");
+        cpuTracer.setScene(scene.spheres, triangles, bvhNodes, scene.models);
+        sceneHash = hashScene(scene, triangles, SCR_WIDTH, SCR_HEIGHT);
+    }
+
+    if (pathFrames > 0 || batchSamples > 0) {
+        int result = pathFrames > 0 ? renderCameraPath(window, pathFrames, pathSamples)
+                                    : renderBatch(batchOffset, batchSamples, batchPath.empty() ? SCREENSHOTS_PATH "batch_" + std::to_string(batchOffset) + ".rtsb" : batchPath);
+        if (!tracePath.empty()) traceWrite(tracePath);
+        delete readback;
+        delete encoder;
+        delete renderer;
+        glfwTerminate();
+        return result;
+    }
+
+    if (!resumePath.empty() && !resumeCheckpoint(resumePath)) {
+        delete readback;
+        delete encoder;
+        delete renderer;
+        glfwTerminate();
+        return -1;
+    }
 
     // uncomment this call to draw in wireframe polygons.
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -177,25 +350,29 @@ int main() {
     auto startTime = std::chrono::high_resolution_clock::now();
     // render loop
     // -----------
+    raytraceTimer = new GpuTimer("raytrace pass");
+    displayTimer = new GpuTimer("display pass");
+    renderer->waitForShader = false;
     while (!glfwWindowShouldClose(window)) {
-        glfwSetWindowTitle(window, std::to_string(frameCount).c_str());
+        TRACE_SCOPE("frame");
+        updateWindowTitle(window);
 
         if (START_RENDER) {
             if (frameCount == 10) {
                 std::cout << "Done 10 samples in: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() << 's' << std::endl;
-                saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, SCREENSHOTS_PATH "10_samples.png");
+                saveScreenshot(SCREENSHOTS_PATH "10_samples");
             }
             if (frameCount == 100) {
                 std::cout << "Done 100 samples in: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() << 's' << std::endl;
-                saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, SCREENSHOTS_PATH "100_samples.png");
+                saveScreenshot(SCREENSHOTS_PATH "100_samples");
             }
             if (frameCount == 1000) {
                 std::cout << "Done 1000 samples in: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() << 's' << std::endl;
-                saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, SCREENSHOTS_PATH "1000_samples.png");
+                saveScreenshot(SCREENSHOTS_PATH "1000_samples");
             }
             if (frameCount == 10000) {
                 std::cout << "Done 10000 samples in: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() << 's' << std::endl;
-                saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, SCREENSHOTS_PATH "10000_samples.png");
+                saveScreenshot(SCREENSHOTS_PATH "10000_samples");
             }
         }
         // if (frameCount == 1000) { saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, "1000_samples_screenshot_100_bounces.png"); }
@@ -203,10 +380,23 @@ int main() {
         std::chrono::time_point<std::chrono::system_clock> startFrame = std::chrono::high_resolution_clock::now();
         // input
         // -----
-        processInput(window);
+        {
+            TRACE_SCOPE("input");
+            ScopedCpuTimer timer(inputStats);
+            processInput(window);
+        }
 
-        int readIdx  = frameCount % 2;
-        int writeIdx = (frameCount + 1) % 2;
+        if (sceneStream) {
+            TRACE_SCOPE("scene stream");
+            updateSceneStream();
+        }
+        // the samples so far were traced without what the new variant compiles in, start over with it
+        if (renderer->useCurrentShader(false)) frameCount = 0;
+        {
+            TRACE_SCOPE("hybrid");
+            ScopedCpuTimer timer(hybridStats);
+            updateHybridRender();
+        }
 
         // render
         // ------
@@ -214,61 +404,65 @@ int main() {
         glClear(GL_COLOR_BUFFER_BIT);
 
         // draw
-
-        // ---------- Pass 1: Raytrace + Accumulate to Texture ----------
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTextures[writeIdx], 0);
-
-        shader.use();
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sphereSSBO);
-        shader.setUint("uResolution", SCR_WIDTH, SCR_HEIGHT);
-        shader.setFloat("uFocalLength", tan(45.0 / 180.0 * 3.1415926)*.5 * (float)SCR_HEIGHT);
-
-        shader.setFloat("cameraPosition", cameraPosition.x, cameraPosition.y, cameraPosition.z);
-        shader.setFloat("cameraForward", cameraForward.x, cameraForward.y, cameraForward.z);
-        shader.setFloat("cameraUp", cameraUp.x, cameraUp.y, cameraUp.z);
-        shader.setFloat("cameraRight", cameraRight.x, cameraRight.y, cameraRight.z);
-
-        shader.setInt("maxBounces_reflection", 10);
-        shader.setInt("maxBounces_transmission", 10);
-        shader.setInt("samplesPerPixel", 1);
-        shader.setUint("renderedFrames", frameCount * ZERO_TOGGLE);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, accumTextures[readIdx]);
-
-        glBindVertexArray(VAO);
-        //glDrawArrays(GL_TRIANGLES, 0, 6);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        // glBindVertexArray(0); // no need to unbind it every time
-
-        // ---------- Pass 2: Display to Screen ----------
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        displayShader.use();
-
-        displayShader.setInt("uTexture", 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, accumTextures[writeIdx]);
-
-        glBindVertexArray(VAO);
-        //glDrawArrays(GL_TRIANGLES, 0, 6);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        // glBindVertexArray(0); // no need to unbind it every time
+        {
+            TRACE_SCOPE("raytrace submit");
+            raytraceTimer->begin();
+            renderer->raytrace(getCamera(), frameCount * ZERO_TOGGLE);
+            raytraceTimer->end();
+        }
+        reportRayStats();
+        writeCheckpoint(frameCount + 1);
+        readback->poll();
+
+        int viewportWidth, viewportHeight;
+        glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+        {
+            TRACE_SCOPE("display submit");
+            displayTimer->begin();
+            renderer->display(viewportWidth, viewportHeight);
+            displayTimer->end();
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            TRACE_SCOPE("swap + poll");
+            ScopedCpuTimer timer(swapStats);
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+
+        raytraceTimer->collect();
+        displayTimer->collect();
+        // begin() collects as well, so compare with what the previous frame saw. Both rates count
+        // pixel samples, the GPU traces samplesPerPixel of them per pixel and frame
+        bool raytraceTimed = raytraceTimer->stats.total() != raytraceTimingsSeen;
+        raytraceTimingsSeen = raytraceTimer->stats.total();
+        if (HYBRID_RENDER && raytraceTimed && raytraceTimer->stats.last() > 0.0)
+            gpuPixelSamplesPerSecond = mix(gpuPixelSamplesPerSecond, renderer->cpuRowStart * SCR_WIDTH * renderer->samplesPerPixel / (raytraceTimer->stats.last() / 1000.0), 0.1);
 
         frameCount++;
         deltaTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startFrame).count();
+        frameStats.add(deltaTime * 1000.0);
     }
 
+    cpuTracer.cancel();
+    if (!checkpointPath.empty()) {
+        lastCheckpoint = {};
+        writeCheckpoint(frameCount);
+    }
+    // stops the mesh builds if the window was closed before they finished
+    delete sceneStream;
+    delete raytraceTimer;
+    delete displayTimer;
+    // writes the screenshots still in flight
+    delete readback;
+    delete encoder;
+    if (!tracePath.empty()) traceWrite(tracePath);
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+    delete renderer;
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -278,52 +472,215 @@ int main() {
 
 
 
-void sendSpheres() {
-    std::vector<Sphere> spheres;
-    Sphere mySphere0 = {vec4(0.0, 0.0, 0.0, 1.0), vec4(1.0, 1.0, 1.0, 0.0), vec4(0.0), vec4(1.0, 2.0, 0.0, 0.0)};
-    Sphere mySphere1 = {vec4(-0.5, -1.0, -1.5, 0.25), vec4(1.0, 0.0, 1.0, 1.0), vec4(1.0), vec4(0.0, 1.0, 0.0, 0.0)};
-    // spheres.push_back(mySphere0);
-    // spheres.push_back(mySphere1);
+Camera getCamera() {
+    return {cameraPosition, cameraForward, cameraUp, cameraRight, uvec2(SCR_WIDTH, SCR_HEIGHT), (float)(tan(45.0 / 180.0 * 3.1415926)*.5 * (float)SCR_HEIGHT)};
+}
+
 
-    glBufferData(GL_SHADER_STORAGE_BUFFER, spheres.size() * sizeof(Sphere), &(spheres[0]), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sphereSSBO);
+// Renders the scene's keyframed camera path to SCREENSHOTS_PATH with `samples` samples per pixel per
+// frame. Readbacks go through PBOs and encoding runs on worker threads, so the GPU traces frame k + 1
+// while frame k is still being copied and written.
+int renderCameraPath(GLFWwindow* window, uint frames, uint samples) {
+    if (scene.cameraPath.empty()) {
+        std::cout << "ERROR::RENDER_PATH::SCENE_HAS_NO_KEYFRAMES" << std::endl;
+        return -1;
+    }
+    std::filesystem::create_directories(SCREENSHOTS_PATH);
+    uint passes = std::max(1u, (samples + renderer->samplesPerPixel - 1) / renderer->samplesPerPixel);
+    float startTime = scene.cameraPath.front().time;
+    float duration = scene.cameraPath.back().time - startTime;
+    // the preview must not wait for vsync
+    glfwSwapInterval(0);
+
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    for (uint frame = 0; frame < frames && !glfwWindowShouldClose(window); frame++) {
+        TRACE_SCOPE("path frame");
+        CameraKeyframe keyframe = sampleCameraPath(scene.cameraPath, startTime + duration * frame / std::max(frames - 1, 1u));
+        cameraPosition = keyframe.position;
+        cameraPitch = keyframe.pitch;
+        cameraYaw = keyframe.yaw;
+        updateCameraAxes();
+
+        for (uint pass = 0; pass < passes; pass++)
+            renderer->raytrace(getCamera(), pass);
+
+        char name[512];
+        snprintf(name, sizeof(name), SCREENSHOTS_PATH "frame_%04u.", frame);
+        readback->request(renderer->accumTexture(), name + imageFormat);
+        readback->poll();
+
+        int viewportWidth, viewportHeight;
+        glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+        renderer->display(viewportWidth, viewportHeight);
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+    readback->finish();
+    encoder->wait();
+    std::cout << "Rendered " << frames << " frames at " << passes * renderer->samplesPerPixel << " spp in: "
+              << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count() << 's' << std::endl;
+    return 0;
 }
 
-void sendTriangles() {
-    glBufferData(GL_SHADER_STORAGE_BUFFER, triangles.size() * sizeof(Triangle), &(triangles[0]), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triangleSSBO);
+// renders the frames firstFrame .. firstFrame + passes - 1 of what a single node would render, so
+// batches with disjoint frame ranges merge into exactly that render's sample set
+int renderBatch(uint firstFrame, uint samples, const std::string &path) {
+    std::filesystem::create_directories(SCREENSHOTS_PATH);
+    uint passes = std::max(1u, (samples + renderer->samplesPerPixel - 1) / renderer->samplesPerPixel);
+    updateCameraAxes();
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    renderer->frameOffset = firstFrame;
+    for (uint pass = 0; pass < passes; pass++) {
+        TRACE_SCOPE("batch pass");
+        renderer->raytrace(getCamera(), pass);
+    }
+    renderer->frameOffset = 0;
+
+    BatchInfo info = {sceneHash, firstFrame, passes};
+    readback->request(renderer->accumTexture(), path, batchMetadata(info));
+    readback->finish();
+    encoder->wait();
+    std::cout << "Rendered frames " << firstFrame << " to " << firstFrame + passes - 1 << " (" << passes * renderer->samplesPerPixel << " spp) in: "
+              << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count() << 's' << std::endl;
+    return 0;
 }
-mat4 defaultRotation = mat4(1);
-void sendModels() {
-    loadTriangles(RESOURCES_PATH "box.obj");
-    Material myMaterial0 = {vec3(0.0, 1.0, 0.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0};
-    Transform myTransform = {vec3(0.0), defaultRotation, vec3(1.0)};
-    Model myModel0 = Model(0, 12, myMaterial0, myTransform);
-    Material myMaterial1 = {vec3(1.0, 0.0, 0.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0};
-    Model myModel1 = Model(12, 12, myMaterial1, myTransform);
-    Material myMaterial2 = {vec3(1.0, 1.0, 1.0), 1.0, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 0.0};
-    Model myModel2 = Model(24, 38, myMaterial2, myTransform);
-    Material myMaterial3 = {vec3(1.0, 1.0, 1.0), 1.0, vec3(1.0), 5.0, 1.0, 0.0, 1.0, 0.0};
-    Model myModel3 = Model(62, 12, myMaterial3, myTransform);
-
-    Material myMaterial4 = {vec3(1.0, 1.0, 1.0), 0.01, vec3(0.0), 0.0, 1.0, 0.0, 1.0, 1.0};
-    Model myModel4 = Model(RESOURCES_PATH "model.obj", myMaterial4, myTransform);
-
-    std::vector<SSBO_Model> SSBO_models;
-    for (Model* model : models) {
-        SSBO_Model returnType = {
-            model->triangleIndex, model->triangleCount, 0u, 0u,
-            vec4(model->boundMin, 0.0), vec4(model->boundMax, 0.0),
-            vec4(model->material.color, model->material.roughness), vec4(model->material.emissionColor, model->material.emissionStrength), vec4(model->material.transmission, model->material.ior, model->material.metalness, 0.0),
-            vec4(model->transform.translation, 0.0), mat4(model->transform.rotation), inverse(mat4(model->transform.rotation))
-        };
-        SSBO_models.push_back(returnType);
-    }
-
-    glBufferData(GL_SHADER_STORAGE_BUFFER, SSBO_models.size() * sizeof(SSBO_Model), &(SSBO_models[0]), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, modelSSBO);
+
+// The renderer only holds one tile, raytrace.frag places it in the image through tileOffset.
+// stdout carries the tiles, so anything printed goes to stderr instead.
+int runTileWorker(const std::string &scenePath) {
+#ifdef _WIN32
+    std::cout << "ERROR::TILES::NOT_SUPPORTED_ON_WINDOWS" << std::endl;
+    return -1;
+#else
+    int output = dup(1);
+    dup2(2, 1);
+    signal(SIGPIPE, SIG_IGN);
+    TileSetup setup;
+    if (!readFully(0, &setup, sizeof(TileSetup))) return -1;
+
+    if (!loadScene(scenePath, scene) || scene.errorCount > 0) return -1;
+    renderer = new Renderer(setup.tileSize, setup.tileSize);
+    renderer->maxBounces_reflection = scene.maxBounces_reflection;
+    renderer->maxBounces_transmission = scene.maxBounces_transmission;
+    renderer->samplesPerPixel = scene.samplesPerPixel;
+    renderer->sendSpheres(scene.spheres);
+    renderer->sendModels(scene.models);
+    renderer->sendTriangles(triangles);
+    renderer->sendBVHNodes(bvhNodes);
+    TileReady ready = {hashScene(scene, triangles, setup.imageWidth, setup.imageHeight)};
+    if (!writeFully(output, &ready, sizeof(TileReady))) return -1;
+
+    Camera camera = makeCamera(scene.cameraPosition, scene.cameraPitch, scene.cameraYaw, uvec2(setup.imageWidth, setup.imageHeight));
+    uint passes = std::max(1u, (setup.samples + renderer->samplesPerPixel - 1) / renderer->samplesPerPixel);
+
+    std::vector<float> pixels(4 * (size_t)setup.tileSize * setup.tileSize);
+    std::vector<float> result;
+    Tile tile;
+    while (readFully(0, &tile, sizeof(Tile))) {
+        TRACE_SCOPE("tile");
+        renderer->tileOffset = uvec2(tile.x, tile.y);
+        for (uint pass = 0; pass < passes; pass++)
+            renderer->raytrace(camera, pass);
+        glBindTexture(GL_TEXTURE_2D, renderer->accumTexture());
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+
+        result.resize(4 * (size_t)tile.width * tile.height);
+        for (uint row = 0; row < tile.height; row++)
+            std::copy_n(&pixels[4 * (size_t)row * setup.tileSize], 4 * tile.width, &result[4 * (size_t)row * tile.width]);
+        if (!writeFully(output, &tile, sizeof(Tile)) || !writeFully(output, result.data(), result.size() * sizeof(float))) break;
+    }
+    delete renderer;
+    return 0;
+#endif
 }
 
+// uploads the models streamed in since the last frame, the accumulation only restarts when there
+// were any; the CPU tracer and the checkpoints get the scene once it is complete
+void updateSceneStream() {
+    size_t oldTriangleCount = triangles.size(), oldNodeCount = bvhNodes.size();
+    if (sceneStream->poll(scene) > 0) {
+        renderer->appendTriangles(triangles, oldTriangleCount);
+        renderer->appendBVHNodes(bvhNodes, oldNodeCount);
+        renderer->sendModels(scene.models);
+        frameCount = 0;
+    }
+    if (!sceneStream->finished()) return;
+    delete sceneStream;
+    sceneStream = nullptr;
+    cpuTracer.setScene(scene.spheres, triangles, bvhNodes, scene.models);
+    sceneHash = hashScene(scene, triangles, SCR_WIDTH, SCR_HEIGHT);
+    std::cout << "Scene loaded: " << scene.models.size() << " models, " << triangles.size() << " triangles" << std::endl;
+}
+
+// picks up finished CPU batches, rebalances the CPU/GPU split from their measured throughput and
+// starts the next batch; the batch is merged by raytrace.frag in the frame its samples are uploaded
+void updateHybridRender() {
+    // the CPU tracer doesn't count traversal work, leave the whole image to the GPU in the debug view
+    // it only gets the scene once streaming is done
+    bool enabled = HYBRID_RENDER && ZERO_TOGGLE && renderer->debugMode == 0 && !sceneStream;
+    if (!enabled || frameCount == 0) {
+        // the accumulation restarts this frame, anything the CPU is still tracing is stale
+        cpuTracer.cancel();
+        cpuFrameIndex = 0;
+        if (!enabled) {
+            renderer->cpuRowStart = SCR_HEIGHT;
+            return;
+        }
+    }
+    if (cpuTracer.isBusy()) return;
+
+    uint cpuRowStart = renderer->cpuRowStart;
+    if (cpuTracer.hasResult()) {
+        uint rows = SCR_HEIGHT - cpuTracer.rowStart;
+        if (rows > 0) {
+            renderer->sendCpuSamples(cpuTracer.rowStart, cpuTracer.samples);
+            cpuPixelSamplesPerSecond = mix(cpuPixelSamplesPerSecond, rows * SCR_WIDTH * cpuTracer.samplesPerPixel / cpuTracer.batchSeconds, 0.5);
+        }
+        cpuTracer.consumeResult();
+
+        // give each device a share of rows proportional to its throughput so both accumulate samples equally fast
+        if (gpuPixelSamplesPerSecond > 0.0 && cpuPixelSamplesPerSecond > 0.0) {
+            double cpuShare = cpuPixelSamplesPerSecond / (cpuPixelSamplesPerSecond + gpuPixelSamplesPerSecond);
+            uint cpuRows = clamp((uint)round(cpuShare * SCR_HEIGHT), 1u, SCR_HEIGHT / 2);
+            cpuRowStart = SCR_HEIGHT - cpuRows;
+        }
+    } else if (cpuRowStart == SCR_HEIGHT) {
+        cpuRowStart = SCR_HEIGHT - max(SCR_HEIGHT / 16, 1u);
+    }
+    renderer->cpuRowStart = cpuRowStart;
+
+    // offset the CPU's frame indices so its random streams never overlap the GPU's
+    cpuTracer.start(getCamera(), cpuRowStart, 0x40000000u + cpuFrameIndex, 1, renderer->maxBounces_reflection, renderer->maxBounces_transmission);
+    cpuFrameIndex++;
+}
+
+// prints the debug view totals about once a second
+void reportRayStats() {
+    if (renderer->debugMode == 0) return;
+    if (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastRayStatsReport).count() < 1) return;
+    RayStats stats;
+    if (!renderer->readRayStats(stats)) return;
+    lastRayStatsReport = std::chrono::high_resolution_clock::now();
+    if (stats.rays == 0) return;
+    std::cout << "Ray stats: " << stats.rays << " rays"
+              << ", " << (double)stats.nodeVisits / stats.rays << " node visits/ray"
+              << ", " << (double)stats.triangleTests / stats.rays << " triangle tests/ray"
+              << ", " << (double)stats.bounces / stats.rays << " bounces/ray"
+              << ", max " << stats.maxTriangleTests << " triangle tests/pixel" << std::endl;
+}
+
+// a few times a second, so the title bar itself doesn't show up in the timings
+void updateWindowTitle(GLFWwindow* window) {
+    auto now = std::chrono::high_resolution_clock::now();
+    if (std::chrono::duration<double>(now - lastTitleUpdate).count() < 0.25) return;
+    lastTitleUpdate = now;
+
+    char title[256];
+    snprintf(title, sizeof(title), "%u spp | raytrace %.2f ms | display %.2f ms | swap %.2f ms | input %.2f ms | hybrid %.2f ms | frame %.2f ms (%.2f-%.2f)",
+        frameCount, raytraceTimer->stats.mean(), displayTimer->stats.mean(), swapStats.mean(), inputStats.mean(), hybridStats.mean(),
+        frameStats.mean(), frameStats.min(), frameStats.max());
+    glfwSetWindowTitle(window, title);
+}
 
 vec3 rotateX(vec3 vector, float angle) {
     float rad = radians(angle);
@@ -333,12 +690,47 @@ vec3 rotateY(vec3 vector, float angle) {
     float rad = radians(angle);
     return vec3(vector.x*cos(rad) - vector.z*sin(rad), vector.y, vector.x*sin(rad) + vector.z*cos(rad));
 }
+void updateCameraAxes() {
+    cameraForward = rotateY(rotateX(vec3(0, 0, 1), cameraPitch), cameraYaw);
+    cameraUp = rotateY(rotateX(vec3(0, 1, 0), cameraPitch), cameraYaw);
+    cameraRight = rotateY(rotateX(vec3(1, 0, 0), cameraPitch), cameraYaw);
+}
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
-unsigned char buffer[3 * SCR_WIDTH * SCR_HEIGHT];
-void saveScreenshot(int x, int y, int width, int height, char name[]) {
-    glReadPixels(x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, &buffer);
-    stbi_write_png(name, SCR_WIDTH, SCR_HEIGHT, 3, &buffer, 3 * SCR_WIDTH);
+// only queues a copy of the accumulation, the PNG is written a frame or two later on an encoder thread;
+// while the previous one of the same name is still on its way, e.g. with ENTER held, it is skipped
+void saveScreenshot(const std::string &name) {
+    std::string path = name + "." + imageFormat;
+    if (readback->isPending(path)) return;
+    readback->request(renderer->accumTexture(), path);
+}
+// nextFrame is the renderedFrames the accumulation continues with, the write happens on an encoder thread
+void writeCheckpoint(uint nextFrame) {
+    // a checkpoint of a partly streamed scene could not be resumed
+    if (checkpointPath.empty() || nextFrame == 0 || !ZERO_TOGGLE || renderer->debugMode != 0 || sceneStream) return;
+    auto now = std::chrono::high_resolution_clock::now();
+    if (std::chrono::duration<double>(now - lastCheckpoint).count() < checkpointInterval) return;
+    lastCheckpoint = now;
+    CheckpointInfo info = {sceneHash, nextFrame, cpuFrameIndex, cameraPosition, cameraPitch, cameraYaw};
+    readback->request(renderer->accumTexture(), checkpointPath, checkpointMetadata(info));
+}
+bool resumeCheckpoint(const std::string &path) {
+    CheckpointInfo info;
+    uint width, height;
+    std::vector<float> pixels;
+    if (!readCheckpoint(path, info, width, height, pixels)) return false;
+    if (info.sceneHash != sceneHash || width != SCR_WIDTH || height != SCR_HEIGHT) {
+        std::cout << "ERROR::CHECKPOINT::SCENE_MISMATCH: " << path << " was rendered from a different scene or resolution" << std::endl;
+        return false;
+    }
+    cameraPosition = info.cameraPosition;
+    cameraPitch = info.cameraPitch;
+    cameraYaw = info.cameraYaw;
+    frameCount = info.frameIndex;
+    cpuFrameIndex = info.cpuFrameIndex;
+    renderer->setAccumulation(pixels);
+    std::cout << "Resumed " << path << " at " << frameCount << " frames" << std::endl;
+    return true;
 }
 auto lastClicked = std::chrono::high_resolution_clock::now();
 void processInput(GLFWwindow *window)
@@ -347,7 +739,7 @@ void processInput(GLFWwindow *window)
         glfwSetWindowShouldClose(window, true);
 
     if (glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS) {
-        saveScreenshot(0, 0, SCR_WIDTH, SCR_HEIGHT, "screenshot_transmission_1.png");
+        saveScreenshot("screenshot_transmission_1");
     }
     if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
         std::cout << "Camera Data:" << std::endl;
@@ -361,6 +753,26 @@ void processInput(GLFWwindow *window)
         START_RENDER = !START_RENDER;
         frameCount = 0;
     }
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
+        if (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastClicked).count() < 1) return;
+        lastClicked = std::chrono::high_resolution_clock::now();
+        std::cout << "toggled hybrid rendering" << std::endl;
+        HYBRID_RENDER = !HYBRID_RENDER;
+        frameCount = 0;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+        if (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastClicked).count() < 1) return;
+        lastClicked = std::chrono::high_resolution_clock::now();
+        traceWrite(tracePath.empty() ? "trace.json" : tracePath);
+    }
+    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) {
+        if (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastClicked).count() < 1) return;
+        lastClicked = std::chrono::high_resolution_clock::now();
+        renderer->debugMode = (renderer->debugMode + 1) % 5;
+        renderer->debugHeatmapMax = debugHeatmapMax[renderer->debugMode];
+        std::cout << "debug view: " << debugModeNames[renderer->debugMode] << std::endl;
+        frameCount = 0;
+    }
     if (glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS) {
         if (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lastClicked).count() < 1) return;
         lastClicked = std::chrono::high_resolution_clock::now();
@@ -389,18 +801,13 @@ void processInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
         pitch += cameraRotateSpeed * deltaTime;
     cameraPitch += pitch;
-    cameraForward = rotateX(vec3(0, 0, 1), cameraPitch);
-    cameraUp = rotateX(vec3(0, 1,0 ), cameraPitch);
-    cameraRight = rotateX(vec3(1, 0, 0), cameraPitch);
     float yaw = 0;
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
         yaw -= cameraRotateSpeed * deltaTime;
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
         yaw += cameraRotateSpeed * deltaTime;
     cameraYaw += yaw;
-    cameraForward = rotateY(cameraForward, cameraYaw);
-    cameraUp = rotateY(cameraUp, cameraYaw);
-    cameraRight = rotateY(cameraRight, cameraYaw);
+    updateCameraAxes();
     frameCount = toAdd == vec3(0) && pitch == 0 && yaw == 0 ? frameCount : 0;
 }
 
@@ -1,16 +1,23 @@
 #include "model.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "objParser.h"
+#include "trace.h"
 
 
+// every file is parsed once, meshes are cached per file and triangle range
+static std::unordered_map<std::string, std::vector<Triangle>> objCache;
+static std::unordered_map<std::string, uint> meshCache;
+
 Model::Model() {
     models.push_back(this);
-    triangleIndex = 0;
-    triangleCount = 1;
-    boundMin = vec3(-0.5);
-    boundMax = vec3(0.5);
+    meshId = 0;
     material.color = vec3(1.0, 0.0, 1.0);
     material.roughness = 1.0f;
     material.emissionColor = vec3(0.0);
@@ -23,56 +30,260 @@ Model::Model() {
     transform.rotation = mat3(1.0);
     transform.scale = vec3(1.0);
 }
+Model::Model(uint meshId_, Material material_, Transform transform_) {
+    models.push_back(this);
+    meshId = meshId_;
+    material = material_;
+    transform = transform_;
+}
 Model::Model(uint triangleIndex_, uint triangleCount_, Material material_, Transform transform_) {
+    TRACE_SCOPE("Model");
     models.push_back(this);
-    triangleIndex = triangleIndex_;
-    triangleCount = triangleCount_;
-    boundMin = vec3(triangles[triangleIndex_].pos_uvx_A);
-    boundMax = vec3(triangles[triangleIndex_].pos_uvx_A);
-    for (uint i = triangleIndex_; i < triangleIndex_ + triangleCount_; i++) {
-        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_A));
-        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_B));
-        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_C));
-        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_A));
-        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_B));
-        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_C));
-    }
+    meshId = addMesh(triangleIndex_, triangleCount_);
     material = material_;
     transform = transform_;
 }
 Model::Model(std::string filePath, Material material_, Transform transform_) {
+    TRACE_SCOPE("Model");
     models.push_back(this);
-    std::vector<Triangle> modelTriangles = getTrianglesFromOBJ(filePath);
-    triangleIndex = triangles.size();
-    triangleCount = modelTriangles.size();
-    boundMin = vec3(modelTriangles[0].pos_uvx_A);
-    boundMax = vec3(modelTriangles[0].pos_uvx_A);
-    for (Triangle triangle : modelTriangles) {
-        triangles.push_back(triangle);
-        boundMin = min(boundMin, vec3(triangle.pos_uvx_A));
-        boundMin = min(boundMin, vec3(triangle.pos_uvx_B));
-        boundMin = min(boundMin, vec3(triangle.pos_uvx_C));
-        boundMax = max(boundMax, vec3(triangle.pos_uvx_A));
-        boundMax = max(boundMax, vec3(triangle.pos_uvx_B));
-        boundMax = max(boundMax, vec3(triangle.pos_uvx_C));
-    }
+    meshId = loadMesh(filePath);
     material = material_;
     transform = transform_;
 }
 SSBO_Model Model::get_SSBO_Model() {
-    SSBO_Model returnType = {
-        triangleIndex, triangleCount, 0u, 0u,
-        vec4(boundMin, 0.0), vec4(boundMax, 0.0),
-        vec4(material.color, material.roughness), vec4(material.emissionColor, material.emissionStrength), vec4(material.transmission, material.ior, material.metalness, 0.0),
-        vec4(transform.translation, 0.0), mat4(transform.rotation), inverse(mat4(transform.rotation))
+    return makeSSBOModel(meshes[meshId], material, transform);
+}
+
+// appends the triangles of an OBJ file to `triangles` and returns how many were added
+uint loadTriangles(std::string filePath) {
+    TRACE_SCOPE("loadTriangles");
+    const std::vector<Triangle> &modelTriangles = loadOBJ(filePath);
+    triangles.insert(triangles.end(), modelTriangles.begin(), modelTriangles.end());
+    return modelTriangles.size();
+}
+
+// the parsed triangles of an OBJ file, only read from disk the first time
+const std::vector<Triangle> &loadOBJ(const std::string &filePath) {
+    auto cached = objCache.find(filePath);
+    if (cached != objCache.end()) return cached->second;
+    return objCache[filePath] = getTrianglesFromOBJ(filePath);
+}
+
+// turns a range of `triangles` into a mesh, its BVH reorders the triangles inside the range
+uint addMesh(uint triangleIndex, uint triangleCount) {
+    Mesh mesh;
+    mesh.triangleIndex = triangleIndex;
+    mesh.triangleCount = triangleCount;
+    mesh.nodeIndex = buildBVH(triangles, triangleIndex, triangleCount, bvhNodes);
+    mesh.nodeCount = bvhNodes.size() - mesh.nodeIndex;
+    mesh.boundMin = bvhNodes[mesh.nodeIndex].boundMin;
+    mesh.boundMax = bvhNodes[mesh.nodeIndex].boundMax;
+    mesh.buildCost = costBVH(bvhNodes, mesh.nodeIndex);
+    meshes.push_back(mesh);
+    return meshes.size() - 1;
+}
+
+uint loadMesh(const std::string &filePath) {
+    return loadMesh(filePath, 0, loadOBJ(filePath).size());
+}
+
+// the mesh for triangles [first, first + count) of an OBJ file, shared by every model that asks for it
+uint loadMesh(const std::string &filePath, uint first, uint count) {
+    std::string key = meshKey(filePath, first, count);
+    auto cached = meshCache.find(key);
+    if (cached != meshCache.end()) return cached->second;
+
+    const std::vector<Triangle> &fileTriangles = loadOBJ(filePath);
+    uint triangleIndex = triangles.size();
+    triangles.insert(triangles.end(), fileTriangles.begin() + first, fileTriangles.begin() + first + count);
+    return meshCache[key] = addMesh(triangleIndex, count);
+}
+
+std::string meshKey(const std::string &filePath, uint first, uint count) {
+    return filePath + "#" + std::to_string(first) + "," + std::to_string(count);
+}
+
+bool findMesh(const std::string &key, uint &meshId) {
+    auto cached = meshCache.find(key);
+    if (cached == meshCache.end()) return false;
+    meshId = cached->second;
+    return true;
+}
+
+// appends a tree built for a mesh whose triangles are already in place, its inner nodes still
+// count from 0
+static uint appendMeshTree(const std::string &key, Mesh mesh, std::vector<BVHNode> &tree) {
+    mesh.nodeIndex = bvhNodes.size();
+    mesh.nodeCount = tree.size();
+    for (BVHNode &node : tree)
+        if (node.triangleCount == 0) node.leftFirst += mesh.nodeIndex;
+    bvhNodes.insert(bvhNodes.end(), tree.begin(), tree.end());
+    mesh.boundMin = bvhNodes[mesh.nodeIndex].boundMin;
+    mesh.boundMax = bvhNodes[mesh.nodeIndex].boundMax;
+    mesh.buildCost = costBVH(bvhNodes, mesh.nodeIndex);
+    meshes.push_back(mesh);
+    return meshCache[key] = meshes.size() - 1;
+}
+
+// for meshes built elsewhere, e.g. by SceneStream: `tree` indexes `meshTriangles` from 0
+uint addBuiltMesh(const std::string &key, const std::vector<Triangle> &meshTriangles, std::vector<BVHNode> &tree) {
+    Mesh mesh;
+    mesh.triangleIndex = triangles.size();
+    mesh.triangleCount = meshTriangles.size();
+    triangles.insert(triangles.end(), meshTriangles.begin(), meshTriangles.end());
+    for (BVHNode &node : tree)
+        if (node.triangleCount > 0) node.leftFirst += mesh.triangleIndex;
+    return appendMeshTree(key, mesh, tree);
+}
+
+// runs work(0) .. work(count - 1) on up to one thread per core
+static void parallelFor(uint count, const std::function<void(uint)> &work) {
+    std::atomic<uint> next(0);
+    auto run = [&]() {
+        for (uint i = next++; i < count; i = next++) work(i);
     };
+    uint threadCount = std::min(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (uint t = 1; t < threadCount; t++)
+        workers.emplace_back(run);
+    run();
+    for (std::thread &worker : workers)
+        worker.join();
+}
 
-    return returnType;
+void preloadOBJs(const std::vector<std::string> &filePaths) {
+    TRACE_SCOPE("preloadOBJs");
+    std::vector<std::string> missing;
+    for (const std::string &filePath : filePaths)
+        if (!objCache.count(filePath) && std::find(missing.begin(), missing.end(), filePath) == missing.end())
+            missing.push_back(filePath);
+    std::vector<std::vector<Triangle>> parsed(missing.size());
+    parallelFor(missing.size(), [&](uint i) {
+        TRACE_SCOPE("parse OBJ");
+        parsed[i] = getTrianglesFromOBJ(missing[i]);
+    });
+    for (size_t i = 0; i < missing.size(); i++)
+        objCache[missing[i]] = std::move(parsed[i]);
+}
+
+// The triangles of every new mesh are appended first so the builds work on disjoint ranges of
+// `triangles`, then each tree is built into its own array and appended in order.
+std::vector<uint> loadMeshes(const std::vector<MeshRange> &ranges) {
+    TRACE_SCOPE("loadMeshes");
+    std::vector<std::string> filePaths;
+    for (const MeshRange &range : ranges) filePaths.push_back(range.filePath);
+    preloadOBJs(filePaths);
+
+    std::vector<std::string> keys;
+    std::vector<std::string> newKeys;
+    std::vector<Mesh> newMeshes;
+    for (const MeshRange &range : ranges) {
+        keys.push_back(meshKey(range.filePath, range.first, range.count));
+        if (meshCache.count(keys.back()) || std::find(newKeys.begin(), newKeys.end(), keys.back()) != newKeys.end()) continue;
+        const std::vector<Triangle> &fileTriangles = objCache[range.filePath];
+        Mesh mesh;
+        mesh.triangleIndex = triangles.size();
+        mesh.triangleCount = range.count;
+        triangles.insert(triangles.end(), fileTriangles.begin() + range.first, fileTriangles.begin() + range.first + range.count);
+        newKeys.push_back(keys.back());
+        newMeshes.push_back(mesh);
+    }
+
+    std::vector<std::vector<BVHNode>> trees(newMeshes.size());
+    parallelFor(newMeshes.size(), [&](uint i) {
+        TRACE_SCOPE("build mesh BVH");
+        buildBVH(triangles, newMeshes[i].triangleIndex, newMeshes[i].triangleCount, trees[i]);
+    });
+
+    for (size_t i = 0; i < newMeshes.size(); i++)
+        appendMeshTree(newKeys[i], newMeshes[i], trees[i]);
+    std::vector<uint> meshIds;
+    for (const std::string &key : keys)
+        meshIds.push_back(meshCache[key]);
+    return meshIds;
+}
+
+// Call after moving the triangles of a mesh. Refits its BVH and only rebuilds it when the tree has
+// degraded too far. Models using the mesh need new SSBO_Models afterwards, its bounds changed; after
+// a rebuild so do the models of every mesh whose nodes lie behind it, see rebuildMesh.
+void updateMesh(uint meshId) {
+    TRACE_SCOPE("updateMesh");
+    Mesh &mesh = meshes[meshId];
+    refitBVH(triangles, bvhNodes, mesh.nodeIndex, mesh.nodeCount);
+    if (costBVH(bvhNodes, mesh.nodeIndex) > mesh.buildCost * REBUILD_THRESHOLD) {
+        rebuildMesh(meshId);
+        return;
+    }
+    mesh.boundMin = bvhNodes[mesh.nodeIndex].boundMin;
+    mesh.boundMax = bvhNodes[mesh.nodeIndex].boundMax;
+}
+
+// Builds the BVH of a mesh from scratch in its place in `bvhNodes`. The new tree can have a
+// different size, the nodes of the meshes behind it are shifted accordingly.
+void rebuildMesh(uint meshId) {
+    TRACE_SCOPE("rebuildMesh");
+    Mesh &mesh = meshes[meshId];
+    std::vector<BVHNode> nodes;
+    buildBVH(triangles, mesh.triangleIndex, mesh.triangleCount, nodes);
+    for (BVHNode &node : nodes)
+        if (node.triangleCount == 0) node.leftFirst += mesh.nodeIndex;
+
+    int shift = (int)nodes.size() - (int)mesh.nodeCount;
+    uint oldEnd = mesh.nodeIndex + mesh.nodeCount;
+    bvhNodes.erase(bvhNodes.begin() + mesh.nodeIndex, bvhNodes.begin() + oldEnd);
+    bvhNodes.insert(bvhNodes.begin() + mesh.nodeIndex, nodes.begin(), nodes.end());
+    if (shift != 0) {
+        for (uint i = mesh.nodeIndex + nodes.size(); i < bvhNodes.size(); i++)
+            if (bvhNodes[i].triangleCount == 0) bvhNodes[i].leftFirst += shift;
+        for (Mesh &other : meshes)
+            if (other.nodeIndex >= oldEnd) other.nodeIndex += shift;
+    }
+
+    mesh.nodeCount = nodes.size();
+    mesh.boundMin = bvhNodes[mesh.nodeIndex].boundMin;
+    mesh.boundMax = bvhNodes[mesh.nodeIndex].boundMax;
+    mesh.buildCost = costBVH(bvhNodes, mesh.nodeIndex);
 }
 
-void loadTriangles(std::string filePath) {
-    std::vector<Triangle> modelTriangles = getTrianglesFromOBJ(filePath);
-    for (Triangle triangle : modelTriangles) {
-        triangles.push_back(triangle);
+// for a file that changed on disk: the next load parses it again and builds new meshes. The old
+// ones stay in the arrays, models created before keep showing them.
+void forgetMeshFile(const std::string &filePath) {
+    objCache.erase(filePath);
+    std::string prefix = filePath + "#";
+    for (auto cached = meshCache.begin(); cached != meshCache.end();) {
+        if (cached->first.compare(0, prefix.size(), prefix) == 0) cached = meshCache.erase(cached);
+        else cached++;
     }
 }
+
+void clearMeshes() {
+    triangles.clear();
+    bvhNodes.clear();
+    meshes.clear();
+    objCache.clear();
+    meshCache.clear();
+}
+void calculateBounds(uint triangleIndex, uint triangleCount, vec3 &boundMin, vec3 &boundMax) {
+    boundMin = vec3(triangles[triangleIndex].pos_uvx_A);
+    boundMax = vec3(triangles[triangleIndex].pos_uvx_A);
+    for (uint i = triangleIndex; i < triangleIndex + triangleCount; i++) {
+        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_A));
+        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_B));
+        boundMin = min(boundMin, vec3(triangles[i].pos_uvx_C));
+        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_A));
+        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_B));
+        boundMax = max(boundMax, vec3(triangles[i].pos_uvx_C));
+    }
+}
+
+SSBO_Model makeSSBOModel(const Mesh &mesh, const Material &material, const Transform &transform) {
+    mat3 worldToModel = mat3(vec3(1.0 / transform.scale.x, 0.0, 0.0), vec3(0.0, 1.0 / transform.scale.y, 0.0), vec3(0.0, 0.0, 1.0 / transform.scale.z)) * transform.rotation;
+    SSBO_Model returnType = {
+        mesh.triangleIndex, mesh.triangleCount, mesh.nodeIndex, 0u,
+        vec4(mesh.boundMin, 0.0), vec4(mesh.boundMax, 0.0),
+        vec4(material.color, material.roughness), vec4(material.emissionColor, material.emissionStrength), vec4(material.transmission, material.ior, material.metalness, 0.0),
+        vec4(transform.translation, 0.0), mat4(worldToModel), inverse(mat4(worldToModel))
+    };
+
+    return returnType;
+}
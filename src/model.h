@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 
+#include "bvh.h"
 #include "objParser.h"
 #include "glm/glm.hpp"
 
@@ -23,10 +24,23 @@ struct Transform {
     mat3 rotation;
     vec3 scale;
 };
+// geometry shared by every model that references it, with its own BVH in `bvhNodes`
+struct Mesh {
+    uint triangleIndex;
+    uint triangleCount;
+    uint nodeIndex;
+    uint nodeCount;
+    vec3 boundMin;
+    vec3 boundMax;
+    // costBVH right after the last full build
+    float buildCost;
+};
+// rotation maps world space into model space including the inverse scale, inverseRotation maps back
 struct SSBO_Model {
     uint triangleIndex;
     uint triangleCount;
-    uint padding[2];
+    uint nodeIndex;
+    uint padding;
 
     vec4 boundMin;
     vec4 boundMax;
@@ -43,20 +57,45 @@ struct SSBO_Model {
 class Model {
     public:
         Model();
+        Model(uint meshId_, Material material_, Transform transform_);
         Model(uint triangleIndex_, uint triangleCount_, Material material_, Transform transform_);
         Model(std::string filePath, Material material_, Transform transform_);
 
         SSBO_Model get_SSBO_Model();
 
-        uint triangleIndex, triangleCount;
-        vec3 boundMin, boundMax;
+        uint meshId;
         Material material;
         Transform transform;
 };
 
-void loadTriangles(std::string filePath);
+uint loadTriangles(std::string filePath);
+const std::vector<Triangle> &loadOBJ(const std::string &filePath);
+uint addMesh(uint triangleIndex, uint triangleCount);
+uint loadMesh(const std::string &filePath);
+uint loadMesh(const std::string &filePath, uint first, uint count);
+
+// batch versions for loading a whole scene: the files are parsed and the BVHs of new meshes built
+// on all cores, the results are the same as loading them one after another
+struct MeshRange {
+    std::string filePath;
+    uint first, count;
+};
+void preloadOBJs(const std::vector<std::string> &filePaths);
+std::vector<uint> loadMeshes(const std::vector<MeshRange> &ranges);
+std::string meshKey(const std::string &filePath, uint first, uint count);
+bool findMesh(const std::string &key, uint &meshId);
+uint addBuiltMesh(const std::string &key, const std::vector<Triangle> &meshTriangles, std::vector<BVHNode> &tree);
+// a refit tree is rebuilt once its SAH cost is this much worse than right after building it
+const float REBUILD_THRESHOLD = 1.5f;
+void updateMesh(uint meshId);
+void rebuildMesh(uint meshId);
+void forgetMeshFile(const std::string &filePath);
+void clearMeshes();
+void calculateBounds(uint triangleIndex, uint triangleCount, vec3 &boundMin, vec3 &boundMax);
+SSBO_Model makeSSBOModel(const Mesh &mesh, const Material &material, const Transform &transform);
 
 inline std::vector<Triangle> triangles;
+inline std::vector<Mesh> meshes;
 inline std::vector<Model*> models;
 
 #endif
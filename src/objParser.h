@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "glm/glm.hpp"
+#include "trace.h"
 
 using namespace glm;
 struct Sphere {
@@ -27,6 +28,7 @@ struct Triangle {
 
 
 inline std::vector<Triangle> getTrianglesFromOBJ(std::string filePath) {
+    TRACE_SCOPE("getTrianglesFromOBJ");
     std::string contents;
     std::ifstream file;
     // file.exceptions (std::ifstream::failbit | std::ifstream::badbit);
@@ -0,0 +1,127 @@
+#include "persistentBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "trace.h"
+
+
+PersistentBuffer::PersistentBuffer(GLuint binding_, size_t recordSize_, GLenum target_) {
+    target = target_;
+    binding = binding_;
+    recordSize = recordSize_;
+    recordCount = 0;
+    capacity = 0;
+    regionBytes = 0;
+    buffer = 0;
+    mapped = nullptr;
+    region = 0;
+    for (uint r = 0; r < REGION_COUNT; r++) fences[r] = nullptr;
+    allocate(16);
+}
+PersistentBuffer::~PersistentBuffer() {
+    for (uint r = 0; r < REGION_COUNT; r++)
+        if (fences[r]) glDeleteSync(fences[r]);
+    glBindBuffer(target, buffer);
+    glUnmapBuffer(target);
+    glDeleteBuffers(1, &buffer);
+}
+
+// Immutable storage cannot grow, so a bigger buffer replaces it. The old one is orphaned, GL keeps
+// it alive until the frames reading it are done, and the new one is filled completely.
+void PersistentBuffer::allocate(size_t capacity_) {
+    TRACE_SCOPE("PersistentBuffer::allocate");
+    if (buffer) {
+        for (uint r = 0; r < REGION_COUNT; r++) {
+            if (fences[r]) glDeleteSync(fences[r]);
+            fences[r] = nullptr;
+        }
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        glDeleteBuffers(1, &buffer);
+    }
+    GLint alignment = 1;
+    glGetIntegerv(target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT : GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    capacity = capacity_;
+    regionBytes = (capacity * recordSize + alignment - 1) / alignment * alignment;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferStorage(target, REGION_COUNT * regionBytes, nullptr, flags);
+    mapped = (char*)glMapBufferRange(target, 0, REGION_COUNT * regionBytes, flags);
+    if (!mapped) std::cout << "ERROR::PERSISTENT_BUFFER::MAP_FAILED" << std::endl;
+
+    records.resize(capacity * recordSize);
+    for (uint r = 0; r < REGION_COUNT; r++) {
+        std::memcpy(mapped + r * regionBytes, records.data(), recordCount * recordSize);
+        dirtyRecords[r].clear();
+    }
+    dirtyMask.assign(capacity, 0);
+}
+
+void PersistentBuffer::setRecords(const void* records_, size_t count) {
+    if (count > capacity) {
+        recordCount = count;
+        records.resize(count * recordSize);
+        std::memcpy(records.data(), records_, count * recordSize);
+        allocate(std::max(count, 2 * capacity));
+        return;
+    }
+    const char* source = (const char*)records_;
+    for (size_t i = 0; i < count; i++) {
+        if (i >= recordCount || std::memcmp(records.data() + i * recordSize, source + i * recordSize, recordSize) != 0) {
+            std::memcpy(records.data() + i * recordSize, source + i * recordSize, recordSize);
+            markDirty(i);
+        }
+    }
+    recordCount = count;
+}
+
+void PersistentBuffer::setRecord(size_t index, const void* record) {
+    if (index >= recordCount) return;
+    std::memcpy(records.data() + index * recordSize, record, recordSize);
+    markDirty(index);
+}
+
+void PersistentBuffer::markDirty(size_t index) {
+    for (uint r = 0; r < REGION_COUNT; r++) {
+        if (dirtyMask[index] & (1u << r)) continue;
+        dirtyMask[index] |= 1u << r;
+        dirtyRecords[r].push_back(index);
+    }
+}
+
+// Keeps reading the current region while it is up to date. Otherwise moves on to the next region,
+// waits for the GPU to be done with it (it was last read REGION_COUNT - 1 switches ago, so this
+// rarely blocks) and writes the records it is missing.
+void PersistentBuffer::bindForFrame() {
+    if (!dirtyRecords[region].empty()) {
+        region = (region + 1) % REGION_COUNT;
+        if (fences[region]) {
+            while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+        char* regionStart = mapped + region * regionBytes;
+        for (size_t index : dirtyRecords[region]) {
+            if (index < recordCount)
+                std::memcpy(regionStart + index * recordSize, records.data() + index * recordSize, recordSize);
+            dirtyMask[index] &= ~(1u << region);
+        }
+        dirtyRecords[region].clear();
+    }
+    glBindBufferRange(target, binding, buffer, region * regionBytes, std::max<size_t>(recordCount, 1) * recordSize);
+}
+
+void PersistentBuffer::fenceFrame() {
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t PersistentBuffer::count() const {
+    return recordCount;
+}
+size_t PersistentBuffer::bytes() const {
+    return REGION_COUNT * regionBytes;
+}
@@ -0,0 +1,58 @@
+#ifndef PERSISTENTBUFFER_H
+#define PERSISTENTBUFFER_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// An immutable SSBO of fixed size records that stays mapped for its whole lifetime. It holds
+// REGION_COUNT copies of the records: the GPU reads one region while the CPU writes changed records
+// into the next one, once the fence of the frames that last read it has passed. Only records that
+// actually changed are written, so moving one model touches one record per region. With
+// GL_UNIFORM_BUFFER as the target a single record serves as a per-frame uniform block.
+class PersistentBuffer {
+    public:
+        static const uint REGION_COUNT = 3;
+
+        PersistentBuffer(GLuint binding_, size_t recordSize_, GLenum target_ = GL_SHADER_STORAGE_BUFFER);
+        ~PersistentBuffer();
+
+        // replaces all records, only the ones that differ from the previous upload are marked dirty
+        void setRecords(const void* records, size_t count);
+        void setRecord(size_t index, const void* record);
+
+        // call around the draw that reads the buffer
+        void bindForFrame();
+        void fenceFrame();
+
+        size_t count() const;
+        size_t bytes() const;
+
+    private:
+        void allocate(size_t capacity_);
+        void markDirty(size_t index);
+
+        GLenum target;
+        GLuint binding;
+        size_t recordSize;
+        size_t recordCount;
+        size_t capacity;
+        size_t regionBytes;
+
+        GLuint buffer;
+        char* mapped;
+        uint region;
+        GLsync fences[REGION_COUNT];
+
+        // CPU copy of the records, the source of every write into a region
+        std::vector<char> records;
+        // bit r is set while region r still misses the latest version of the record
+        std::vector<uint8_t> dirtyMask;
+        std::vector<size_t> dirtyRecords[REGION_COUNT];
+};
+
+#endif
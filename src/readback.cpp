@@ -0,0 +1,82 @@
+#include "readback.h"
+#include <cstring>
+
+#include "trace.h"
+
+
+FrameReadback::FrameReadback(uint width_, uint height_, ImageEncoder &encoder_) : encoder(encoder_) {
+    width = width_;
+    height = height_;
+    next = 0;
+    for (Slot &slot : slots) {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * sizeof(float) * (size_t)width * height, nullptr, GL_STREAM_READ);
+        slot.fence = nullptr;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+FrameReadback::~FrameReadback() {
+    finish();
+    for (Slot &slot : slots)
+        glDeleteBuffers(1, &slot.pbo);
+}
+
+void FrameReadback::request(GLuint texture, const std::string &path, const std::string &metadata) {
+    TRACE_SCOPE("readback request");
+    Slot &slot = slots[next];
+    if (slot.fence) complete(slot);
+    next = (next + 1) % SLOT_COUNT;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.path = path;
+    slot.metadata = metadata;
+}
+
+bool FrameReadback::isPending(const std::string &path) {
+    for (Slot &slot : slots)
+        if (slot.fence && slot.path == path) return true;
+    return encoder.isPending(path);
+}
+
+void FrameReadback::poll() {
+    // oldest first, so the images reach the encoder in the order they were requested
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        Slot &slot = slots[(next + i) % SLOT_COUNT];
+        if (!slot.fence) continue;
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+        complete(slot);
+    }
+}
+
+void FrameReadback::finish() {
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        Slot &slot = slots[(next + i) % SLOT_COUNT];
+        if (slot.fence) complete(slot);
+    }
+}
+
+void FrameReadback::complete(Slot &slot) {
+    TRACE_SCOPE("readback complete");
+    while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    EncodeJob job;
+    job.path = slot.path;
+    job.metadata = slot.metadata;
+    job.width = width;
+    job.height = height;
+    job.pixels.resize(4 * (size_t)width * height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job.pixels.size() * sizeof(float), GL_MAP_READ_BIT);
+    if (mapped) std::memcpy(job.pixels.data(), mapped, job.pixels.size() * sizeof(float));
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    encoder.submit(std::move(job));
+}
@@ -0,0 +1,43 @@
+#ifndef READBACK_H
+#define READBACK_H
+#include <string>
+
+#include "imageEncoder.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// Copies RGBA32F textures into pixel buffer objects and hands them to an ImageEncoder once their
+// fence has passed, a frame or two later. The GPU keeps rendering while a copy is in flight; only
+// running out of slots waits, for the oldest one.
+class FrameReadback {
+    public:
+        FrameReadback(uint width_, uint height_, ImageEncoder &encoder_);
+        ~FrameReadback();
+
+        void request(GLuint texture, const std::string &path, const std::string &metadata = "");
+        // whether `path` is still being copied or written
+        bool isPending(const std::string &path);
+        // collects finished copies without blocking
+        void poll();
+        // collects every copy, waiting for the GPU if needed
+        void finish();
+
+    private:
+        static const int SLOT_COUNT = 3;
+        struct Slot {
+            GLuint pbo;
+            GLsync fence;
+            std::string path;
+            std::string metadata;
+        };
+        void complete(Slot &slot);
+
+        uint width, height;
+        ImageEncoder &encoder;
+        Slot slots[SLOT_COUNT];
+        int next;
+};
+
+#endif
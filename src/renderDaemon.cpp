@@ -0,0 +1,348 @@
+#include "renderDaemon.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "bvh.h"
+#include "model.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+RenderDaemon::RenderDaemon(const std::string &socketPath_) : encoder(2) {
+    socketPath = socketPath_;
+    listenFd = -1;
+    jobStarted = false;
+    nextJobId = 1;
+    stopping = false;
+    wakePipe[0] = wakePipe[1] = -1;
+}
+RenderDaemon::~RenderDaemon() {
+    // the callbacks of images still being written use the pipe
+    encoder.wait();
+#ifndef _WIN32
+    for (int fd : wakePipe)
+        if (fd >= 0) close(fd);
+    for (Client &client : clients)
+        close(client.fd);
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+#endif
+    for (auto &entry : renderers)
+        delete entry.second.renderer;
+}
+
+#ifndef _WIN32
+
+// a client that lets this much output pile up without reading it is dropped
+static const size_t MAX_CLIENT_OUTPUT = 1 << 20;
+
+bool RenderDaemon::run() {
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cout << "ERROR::DAEMON::SOCKET_PATH_TOO_LONG: " << socketPath << std::endl;
+        return false;
+    }
+    std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+    // a stale socket from a daemon that was killed would make bind fail
+    unlink(socketPath.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+        std::cout << "ERROR::DAEMON::SOCKET_NOT_OPENED: " << socketPath << std::endl;
+        return false;
+    }
+    if (pipe(wakePipe) != 0) {
+        std::cout << "ERROR::DAEMON::PIPE_NOT_OPENED" << std::endl;
+        return false;
+    }
+    // the encoder threads must never block on it
+    fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL) | O_NONBLOCK);
+    std::cout << "Listening on " << socketPath << std::endl;
+
+    while (!stopping) {
+        std::vector<pollfd> fds = {{listenFd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        for (Client &client : clients)
+            fds.push_back({client.fd, (short)(client.output.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        // only sleep when there is nothing to render
+        if (poll(fds.data(), fds.size(), jobs.empty() ? -1 : 0) > 0) {
+            if (fds[0].revents) acceptClients();
+            if (fds[1].revents) reportEncoded();
+            for (size_t i = 2; i < fds.size(); i++) {
+                Client &client = clients[i - 2];
+                if (fds[i].revents & POLLOUT) writeClient(client);
+                if (client.fd >= 0 && (fds[i].revents & ~POLLOUT)) readClient(client);
+            }
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &client) { return client.fd < 0; }), clients.end());
+        }
+
+        if (jobs.empty()) continue;
+        Job &job = jobs.front();
+        if (!jobStarted) {
+            jobStarted = startJob(job);
+            if (!jobStarted) {
+                jobs.pop_front();
+                continue;
+            }
+        }
+        stepJob(job);
+        if (job.passesDone == job.passes) {
+            jobs.pop_front();
+            jobStarted = false;
+        }
+    }
+    // whatever the sockets take right away, e.g. the reply to shutdown
+    encoder.wait();
+    reportEncoded();
+    for (Client &client : clients)
+        writeClient(client);
+    return true;
+}
+
+void RenderDaemon::acceptClients() {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+    // replies are buffered, a client that is slow to read must not stall the render loop
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    clients.push_back({fd, "", ""});
+}
+
+void RenderDaemon::readClient(Client &client) {
+    char buffer[4096];
+    ssize_t count = read(client.fd, buffer, sizeof(buffer));
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (count <= 0) {
+        closeClient(client);
+        return;
+    }
+    client.input.append(buffer, count);
+    size_t end;
+    while (client.fd >= 0 && (end = client.input.find('\n')) != std::string::npos) {
+        std::string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        handleCommand(client, line);
+    }
+}
+
+void RenderDaemon::handleCommand(Client &client, const std::string &line) {
+    std::istringstream stream(line);
+    std::string command;
+    if (!(stream >> command)) return;
+    if (command == "shutdown") {
+        reply(client.fd, "bye");
+        stopping = true;
+        return;
+    }
+    if (command != "render") {
+        reply(client.fd, "error 0 unknown command " + command);
+        return;
+    }
+
+    Job job = {};
+    job.id = nextJobId++;
+    job.client = client.fd;
+    if (!(stream >> job.scenePath >> job.resolution.x >> job.resolution.y >> job.samples >> job.outputPath)
+        || job.resolution.x == 0 || job.resolution.y == 0) {
+        reply(client.fd, "error " + std::to_string(job.id) + " usage: render <scene> <width> <height> <spp> <output> [<x y z> <pitch> <yaw>]");
+        return;
+    }
+    job.hasCamera = (bool)(stream >> job.cameraPosition.x >> job.cameraPosition.y >> job.cameraPosition.z >> job.cameraPitch >> job.cameraYaw);
+    jobs.push_back(job);
+    reply(client.fd, "queued " + std::to_string(job.id));
+}
+
+void RenderDaemon::reply(int fd, const std::string &line) {
+    auto client = std::find_if(clients.begin(), clients.end(), [fd](const Client &client) { return client.fd == fd; });
+    if (fd < 0 || client == clients.end()) return;
+    client->output += line + "\n";
+    writeClient(*client);
+}
+
+// sends as much of the client's output as its socket takes without blocking
+void RenderDaemon::writeClient(Client &client) {
+    while (client.fd >= 0 && !client.output.empty()) {
+        ssize_t count = write(client.fd, client.output.data(), client.output.size());
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (count <= 0) {
+            closeClient(client);
+            return;
+        }
+        client.output.erase(0, count);
+    }
+    if (client.output.size() > MAX_CLIENT_OUTPUT) {
+        std::cout << "ERROR::DAEMON::CLIENT_NOT_READING: dropped after " << client.output.size() << " bytes of replies" << std::endl;
+        closeClient(client);
+    }
+}
+
+void RenderDaemon::closeClient(Client &client) {
+    // its queued jobs have nobody to report to
+    for (Job &job : jobs)
+        if (job.client == client.fd) job.client = -1;
+    for (Encoding &encoding : encodings)
+        if (encoding.client == client.fd) encoding.client = -1;
+    close(client.fd);
+    client.fd = -1;
+    client.output.clear();
+}
+
+bool RenderDaemon::startJob(Job &job) {
+    TRACE_SCOPE("daemon startJob");
+    job.start = job.lastProgress = std::chrono::high_resolution_clock::now();
+    const Scene* scene = loadCachedScene(job.scenePath);
+    if (!scene) {
+        reply(job.client, "error " + std::to_string(job.id) + " scene not loaded: " + job.scenePath);
+        return false;
+    }
+    job.renderer = cachedRenderer(job.resolution, *scene);
+    job.camera = job.hasCamera ? makeCamera(job.cameraPosition, job.cameraPitch, job.cameraYaw, job.resolution)
+                               : makeCamera(scene->cameraPosition, scene->cameraPitch, scene->cameraYaw, job.resolution);
+    job.passes = std::max(1u, (job.samples + job.renderer->samplesPerPixel - 1) / job.renderer->samplesPerPixel);
+    job.passesDone = 0;
+    return true;
+}
+
+void RenderDaemon::stepJob(Job &job) {
+    TRACE_SCOPE("daemon pass");
+    job.renderer->raytrace(job.camera, job.passesDone);
+    job.passesDone++;
+
+    auto now = std::chrono::high_resolution_clock::now();
+    if (job.passesDone < job.passes) {
+        if (std::chrono::duration<double>(now - job.lastProgress).count() >= 0.1) {
+            job.lastProgress = now;
+            reply(job.client, "progress " + std::to_string(job.id) + " " + std::to_string(job.passesDone * job.renderer->samplesPerPixel) + " " + std::to_string(job.passes * job.renderer->samplesPerPixel));
+        }
+        return;
+    }
+
+    EncodeJob image;
+    image.path = job.outputPath;
+    image.width = job.resolution.x;
+    image.height = job.resolution.y;
+    image.pixels.resize(4 * (size_t)image.width * image.height);
+    glBindTexture(GL_TEXTURE_2D, job.renderer->accumTexture());
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, image.pixels.data());
+    // the loop keeps serving clients and rendering the next job while the image is written
+    encodings.push_back({job.id, job.client, job.outputPath, job.start});
+    uint id = job.id;
+    image.onWritten = [this, id](bool written) {
+        {
+            std::lock_guard<std::mutex> lock(encodedMutex);
+            encoded.push_back({id, written});
+        }
+        char wake = 1;
+        if (write(wakePipe[1], &wake, 1) < 0) {} // a full pipe wakes the loop just as well
+    };
+    encoder.submit(std::move(image));
+}
+
+// replies done (or error) to the clients whose images have been written since the last call
+void RenderDaemon::reportEncoded() {
+    char buffer[64];
+    while (read(wakePipe[0], buffer, sizeof(buffer)) == (ssize_t)sizeof(buffer)) {}
+    std::vector<std::pair<uint, bool>> finished;
+    {
+        std::lock_guard<std::mutex> lock(encodedMutex);
+        finished.swap(encoded);
+    }
+    for (const auto &result : finished) {
+        auto encoding = std::find_if(encodings.begin(), encodings.end(), [&result](const Encoding &encoding) { return encoding.id == result.first; });
+        if (encoding == encodings.end()) continue;
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encoding->start).count();
+        if (result.second) reply(encoding->client, "done " + std::to_string(encoding->id) + " " + encoding->outputPath + " " + std::to_string(milliseconds));
+        else reply(encoding->client, "error " + std::to_string(encoding->id) + " could not write " + encoding->outputPath);
+        encodings.erase(encoding);
+    }
+}
+
+#else
+
+bool RenderDaemon::run() {
+    std::cout << "ERROR::DAEMON::NOT_SUPPORTED_ON_WINDOWS" << std::endl;
+    return false;
+}
+
+#endif
+
+// drops the parsed triangles and meshes of OBJ files that changed on disk, see forgetMeshFile
+void RenderDaemon::forgetChangedMeshFiles() {
+    for (auto &file : meshFiles) {
+        std::error_code error;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(file.first, error);
+        if (error || modified == file.second) continue;
+        forgetMeshFile(file.first);
+        file.second = modified;
+    }
+}
+
+// reparsed only when the scene file or one of its OBJ files changed; unchanged meshes stay cached
+// by loadMesh either way
+const Scene* RenderDaemon::loadCachedScene(const std::string &path) {
+    std::error_code error;
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+    if (error) return nullptr;
+    forgetChangedMeshFiles();
+    auto cached = scenes.find(path);
+    if (cached != scenes.end() && cached->second.modified == modified) {
+        bool meshesChanged = false;
+        for (const auto &file : cached->second.meshFilesModified)
+            meshesChanged = meshesChanged || meshFiles[file.first] != file.second;
+        if (!meshesChanged) return &cached->second.scene;
+    }
+
+    TRACE_SCOPE("daemon loadScene");
+    Scene scene;
+    // the job fails rather than rendering a scene with lines missing
+    if (!loadScene(path, scene) || scene.errorCount > 0) return nullptr;
+    // renderers showing the old version must upload the new one
+    for (auto &entry : renderers)
+        if (cached != scenes.end() && entry.second.scene == &cached->second.scene) entry.second.scene = nullptr;
+    CachedScene &entry = scenes[path];
+    entry.scene = std::move(scene);
+    entry.modified = modified;
+    entry.meshFilesModified.clear();
+    for (const std::string &file : entry.scene.meshFiles) {
+        // files seen for the first time were just parsed
+        if (!meshFiles.count(file)) meshFiles[file] = std::filesystem::last_write_time(file, error);
+        entry.meshFilesModified[file] = meshFiles[file];
+    }
+    return &entry.scene;
+}
+
+Renderer* RenderDaemon::cachedRenderer(uvec2 resolution, const Scene &scene) {
+    CachedRenderer &cached = renderers[{resolution.x, resolution.y}];
+    if (!cached.renderer) {
+        TRACE_SCOPE("daemon Renderer");
+        cached.renderer = new Renderer(resolution.x, resolution.y);
+    }
+    Renderer* renderer = cached.renderer;
+    if (cached.triangleCount != triangles.size() || cached.nodeCount != bvhNodes.size()) {
+        renderer->sendTriangles(triangles);
+        renderer->sendBVHNodes(bvhNodes);
+        cached.triangleCount = triangles.size();
+        cached.nodeCount = bvhNodes.size();
+    }
+    if (cached.scene != &scene) {
+        renderer->sendSpheres(scene.spheres);
+        renderer->sendModels(scene.models);
+        cached.scene = &scene;
+    }
+    renderer->maxBounces_reflection = scene.maxBounces_reflection;
+    renderer->maxBounces_transmission = scene.maxBounces_transmission;
+    renderer->samplesPerPixel = scene.samplesPerPixel;
+    return renderer;
+}
@@ -0,0 +1,113 @@
+#ifndef RENDERDAEMON_H
+#define RENDERDAEMON_H
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "imageEncoder.h"
+#include "renderer.h"
+#include "scene.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// Long-running render service on a Unix socket. Parsed scenes, meshes, BVHs and a compiled
+// Renderer per resolution stay resident between jobs, so a job only pays for its samples.
+// Clients send one command per line:
+//
+//   render <scene> <width> <height> <spp> <output> [<x y z> <pitch> <yaw>]
+//   shutdown
+//
+// and get back "queued <id>", then "progress <id> <samples> <spp>" while it renders and finally
+// "done <id> <output> <milliseconds>" or "error <id> <reason>". Jobs run one at a time in the order
+// they arrive; the camera defaults to the scene's. The output format follows its extension, e.g.
+//     echo "render resources/default.scene 480 270 64 preview.png" | nc -U /tmp/raytracer.sock
+class RenderDaemon {
+    public:
+        RenderDaemon(const std::string &socketPath_);
+        ~RenderDaemon();
+
+        // serves until a client sends shutdown; false if the socket could not be opened
+        bool run();
+
+    private:
+        struct Client {
+            int fd;
+            std::string input;
+            // replies the socket didn't take yet, sent when poll says it can
+            std::string output;
+        };
+        struct Job {
+            uint id;
+            int client;
+            std::string scenePath;
+            uvec2 resolution;
+            uint samples;
+            std::string outputPath;
+            bool hasCamera;
+            vec3 cameraPosition;
+            float cameraPitch, cameraYaw;
+
+            Renderer* renderer;
+            Camera camera;
+            uint passes, passesDone;
+            std::chrono::high_resolution_clock::time_point start, lastProgress;
+        };
+        // a finished job whose image is still being written, reported done once it is
+        struct Encoding {
+            uint id;
+            int client;
+            std::string outputPath;
+            std::chrono::high_resolution_clock::time_point start;
+        };
+        struct CachedScene {
+            Scene scene;
+            std::filesystem::file_time_type modified;
+            // of each of scene.meshFiles when it was loaded
+            std::map<std::string, std::filesystem::file_time_type> meshFilesModified;
+        };
+        struct CachedRenderer {
+            Renderer* renderer;
+            // what was uploaded last, the mesh arrays only ever grow
+            size_t triangleCount, nodeCount;
+            const Scene* scene;
+        };
+
+        void acceptClients();
+        void readClient(Client &client);
+        void handleCommand(Client &client, const std::string &line);
+        void reply(int fd, const std::string &line);
+        void writeClient(Client &client);
+        void closeClient(Client &client);
+        bool startJob(Job &job);
+        void stepJob(Job &job);
+        void reportEncoded();
+        void forgetChangedMeshFiles();
+        const Scene* loadCachedScene(const std::string &path);
+        Renderer* cachedRenderer(uvec2 resolution, const Scene &scene);
+
+        std::string socketPath;
+        int listenFd;
+        std::vector<Client> clients;
+        std::deque<Job> jobs;
+        bool jobStarted;
+        std::map<std::string, CachedScene> scenes;
+        // OBJ files in the mesh caches and their time stamps when they were parsed
+        std::map<std::string, std::filesystem::file_time_type> meshFiles;
+        std::map<std::pair<uint, uint>, CachedRenderer> renderers;
+        std::vector<Encoding> encodings;
+        // filled by the encoder threads with the ids and results of written images; a byte written
+        // to wakePipe makes the daemon loop's poll return to report them
+        std::mutex encodedMutex;
+        std::vector<std::pair<uint, bool>> encoded;
+        int wakePipe[2];
+        ImageEncoder encoder;
+        uint nextJobId;
+        bool stopping;
+};
+
+#endif
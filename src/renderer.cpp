@@ -0,0 +1,435 @@
+#include "renderer.h"
+#include <algorithm>
+#include <cmath>
+
+#include "trace.h"
+
+// RayStatsBuffer in raytrace.frag: rays, node visits, triangle tests and bounces as low, high word pairs
+struct GPURayStats {
+    uint totals[8];
+    uint maxTriangleTests;
+};
+
+Renderer::Renderer(uint width_, uint height_)
+    : displayShader(RESOURCES_PATH "/default.vert", RESOURCES_PATH "/display.frag"),
+      sphereBuffer(0, sizeof(GPUSphere)),
+      modelBuffer(2, sizeof(GPUModel)),
+      materialBuffer(5, sizeof(GPUMaterial)),
+      frameBuffer(0, sizeof(FrameConstants), GL_UNIFORM_BUFFER) {
+    TRACE_SCOPE("Renderer buffers");
+    width = width_;
+    height = height_;
+    maxBounces_reflection = 10;
+    maxBounces_transmission = 10;
+    samplesPerPixel = 1;
+    frameOffset = 0;
+    tileOffset = uvec2(0);
+    cpuRowStart = height;
+    cpuSamplesReady = false;
+    cpuBatchRowStart = height;
+    writeIdx = 0;
+    debugMode = 0;
+    debugHeatmapMax = 64.0f;
+    rayStatsFence = nullptr;
+    triangleBytes = bvhBytes = triangleEdgeBytes = 0;
+    triangleFormat = sentTriangleFormat = TRIANGLE_VERTICES;
+    shader = pendingShader = nullptr;
+    shaderDirty = true;
+    waitForShader = true;
+    shaderBounces_reflection = shaderBounces_transmission = -1;
+    sphereFeatures = modelFeatures = 0;
+    materialsChanged = false;
+
+    // set up vertex data (and buffer(s)) and configure vertex attributes
+    // ------------------------------------------------------------------
+    float vertices[] = {
+         1.0f,  1.0f, 0.0f,  1.0, 1.0,  // top right
+         1.0f, -1.0f, 0.0f,  1.0, 0.0,  // bottom right
+        -1.0f, -1.0f, 0.0f,  0.0, 0.0,  // bottom left
+        -1.0f,  1.0f, 0.0f,  0.0, 1.0   // top left
+    };
+    unsigned int indices[] = {  // note that we start from 0!
+        0, 1, 3,  // first Triangle
+        1, 2, 3   // second Triangle
+    };
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3*sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // remember: do NOT unbind the EBO while a VAO is active as the bound element buffer object IS stored in the VAO; keep the EBO bound.
+    glBindVertexArray(0);
+
+    // Create 2 textures for ping-pong accumulation
+    glGenTextures(2, accumTextures);
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, accumTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    // CPU samples are uploaded here before being merged into the accumulation
+    glGenTextures(1, &cpuSampleTexture);
+    glBindTexture(GL_TEXTURE_2D, cpuSampleTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // Framebuffer for rendering accumulation
+    glGenFramebuffers(1, &fbo);
+
+    glGenBuffers(1, &triangleSSBO);
+    glGenBuffers(1, &bvhSSBO);
+    glGenBuffers(1, &triangleEdgeSSBO);
+
+    // debug view counters, copied to rayStatsReadback so reading them never waits on frames in flight
+    GPURayStats zeroStats = {};
+    glGenBuffers(1, &rayStatsSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayStatsSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPURayStats), &zeroStats, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &rayStatsReadback);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, rayStatsReadback);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GPURayStats), nullptr, GL_STREAM_READ);
+
+    glGenTextures(1, &rayStatsImage);
+    glBindTexture(GL_TEXTURE_2D, rayStatsImage);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, width, height);
+}
+Renderer::~Renderer() {
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteTextures(2, accumTextures);
+    glDeleteTextures(1, &cpuSampleTexture);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteBuffers(1, &triangleSSBO);
+    glDeleteBuffers(1, &bvhSSBO);
+    glDeleteBuffers(1, &triangleEdgeSSBO);
+    glDeleteBuffers(1, &rayStatsSSBO);
+    glDeleteBuffers(1, &rayStatsReadback);
+    glDeleteTextures(1, &rayStatsImage);
+    if (rayStatsFence) glDeleteSync(rayStatsFence);
+    for (auto &variant : shaderVariants)
+        glDeleteProgram(variant.second.ID);
+    glDeleteProgram(displayShader.ID);
+}
+
+// material features the shader variant is compiled for, see shaderDefines
+static const uint FEATURE_METAL = 1;
+static const uint FEATURE_TRANSMISSION = 2;
+static uint materialFeatures(const vec4 &transmission_ior_metalness_tbd) {
+    return (transmission_ior_metalness_tbd.b > 0.0f ? FEATURE_METAL : 0) | (transmission_ior_metalness_tbd.r > 0.0f ? FEATURE_TRANSMISSION : 0);
+}
+
+// Materials are deduplicated by value and never removed, a renderer showing one scene after another
+// only grows the table by the materials it hasn't seen yet.
+uint Renderer::materialIndex(const vec4 &color_roughness, const vec4 &emissionColor_emissionStrength, const vec4 &transmission_ior_metalness_tbd) {
+    GPUMaterial material = {color_roughness, emissionColor_emissionStrength, transmission_ior_metalness_tbd};
+    std::string key((const char*)&material, sizeof(GPUMaterial));
+    auto index = materialIndices.find(key);
+    if (index != materialIndices.end()) return index->second;
+    materials.push_back(material);
+    materialsChanged = true;
+    return materialIndices[key] = materials.size() - 1;
+}
+GPUSphere Renderer::gpuSphere(const Sphere &sphere) {
+    return {sphere.pos_radius, materialIndex(sphere.color_roughness, sphere.emissionColor_emissionStrength, sphere.transmission_ior_metalness_tbd), {0, 0, 0}};
+}
+GPUModel Renderer::gpuModel(const SSBO_Model &model) {
+    return {
+        model.triangleIndex, model.triangleCount, model.nodeIndex,
+        materialIndex(model.color_roughness, model.emissionColor_emissionStrength, model.transmission_ior_metalness_tbd),
+        model.boundMin, model.boundMax, model.translation, model.rotation
+    };
+}
+
+// spheres and models live in persistently mapped buffers, resending an unchanged scene uploads nothing
+void Renderer::sendSpheres(const std::vector<Sphere> &spheres) {
+    TRACE_SCOPE("sendSpheres");
+    std::vector<GPUSphere> records;
+    records.reserve(spheres.size());
+    sphereFeatures = 0;
+    for (const Sphere &sphere : spheres) {
+        records.push_back(gpuSphere(sphere));
+        sphereFeatures |= materialFeatures(sphere.transmission_ior_metalness_tbd);
+    }
+    sphereBuffer.setRecords(records.data(), records.size());
+    shaderDirty = true;
+}
+static GPUTriangleEdges edgeRecord(const Triangle &triangle) {
+    vec3 edgeAB = vec3(triangle.pos_uvx_B) - vec3(triangle.pos_uvx_A);
+    vec3 edgeAC = vec3(triangle.pos_uvx_C) - vec3(triangle.pos_uvx_A);
+    vec3 normal = cross(edgeAB, edgeAC);
+    return {vec4(vec3(triangle.pos_uvx_A), normal.x), vec4(edgeAB, normal.y), vec4(edgeAC, normal.z)};
+}
+// rebuilds the records from `first` on
+static void buildTriangleEdges(const std::vector<Triangle> &triangles, size_t first, std::vector<GPUTriangleEdges> &records) {
+    records.resize(first);
+    records.reserve(triangles.size());
+    for (size_t i = first; i < triangles.size(); i++)
+        records.push_back(edgeRecord(triangles[i]));
+}
+void Renderer::sendTriangles(const std::vector<Triangle> &triangles) {
+    TRACE_SCOPE("sendTriangles");
+    triangleBytes = triangles.size() * sizeof(Triangle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, triangleBytes, triangles.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triangleSSBO);
+
+    // the edge buffer is dropped again in the other formats
+    sentTriangleFormat = triangleFormat;
+    if (triangleFormat == TRIANGLE_EDGES) buildTriangleEdges(triangles, 0, triangleEdges);
+    else std::vector<GPUTriangleEdges>().swap(triangleEdges);
+    triangleEdgeBytes = triangleEdges.size() * sizeof(GPUTriangleEdges);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleEdgeSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, triangleEdgeBytes, triangleEdges.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, triangleEdgeSSBO);
+    shaderDirty = true;
+}
+void Renderer::sendModels(const std::vector<SSBO_Model> &models) {
+    TRACE_SCOPE("sendModels");
+    std::vector<GPUModel> records;
+    records.reserve(models.size());
+    modelFeatures = 0;
+    for (const SSBO_Model &model : models) {
+        records.push_back(gpuModel(model));
+        modelFeatures |= materialFeatures(model.transmission_ior_metalness_tbd);
+    }
+    modelBuffer.setRecords(records.data(), records.size());
+    shaderDirty = true;
+}
+void Renderer::updateSphere(uint index, const Sphere &sphere) {
+    GPUSphere record = gpuSphere(sphere);
+    sphereBuffer.setRecord(index, &record);
+    uint features = sphereFeatures | materialFeatures(sphere.transmission_ior_metalness_tbd);
+    shaderDirty = shaderDirty || features != sphereFeatures;
+    sphereFeatures = features;
+}
+void Renderer::updateModel(uint index, const SSBO_Model &model) {
+    GPUModel record = gpuModel(model);
+    modelBuffer.setRecord(index, &record);
+    uint features = modelFeatures | materialFeatures(model.transmission_ior_metalness_tbd);
+    shaderDirty = shaderDirty || features != modelFeatures;
+    modelFeatures = features;
+}
+void Renderer::sendBVHNodes(const std::vector<BVHNode> &nodes) {
+    TRACE_SCOPE("sendBVHNodes");
+    bvhBytes = nodes.size() * sizeof(BVHNode);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bvhBytes, nodes.data(), GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvhSSBO);
+}
+
+static void appendRecords(GLuint buffer, GLuint binding, size_t &capacity, const void* data, size_t bytes, size_t firstByte) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    if (bytes > capacity) {
+        capacity = std::max(bytes, 2 * capacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_COPY);
+        firstByte = 0;
+    }
+    if (bytes > firstByte) glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstByte, bytes - firstByte, (const char*)data + firstByte);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+void Renderer::appendTriangles(const std::vector<Triangle> &triangles, size_t first) {
+    TRACE_SCOPE("appendTriangles");
+    appendRecords(triangleSSBO, 1, triangleBytes, triangles.data(), triangles.size() * sizeof(Triangle), first * sizeof(Triangle));
+    if (sentTriangleFormat == TRIANGLE_EDGES) {
+        buildTriangleEdges(triangles, first, triangleEdges);
+        appendRecords(triangleEdgeSSBO, 6, triangleEdgeBytes, triangleEdges.data(), triangleEdges.size() * sizeof(GPUTriangleEdges), first * sizeof(GPUTriangleEdges));
+    }
+}
+void Renderer::appendBVHNodes(const std::vector<BVHNode> &nodes, size_t first) {
+    TRACE_SCOPE("appendBVHNodes");
+    appendRecords(bvhSSBO, 4, bvhBytes, nodes.data(), nodes.size() * sizeof(BVHNode), first * sizeof(BVHNode));
+}
+void Renderer::updateTriangles(const std::vector<Triangle> &triangles, size_t first, size_t count) {
+    TRACE_SCOPE("updateTriangles");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(Triangle), count * sizeof(Triangle), triangles.data() + first);
+    if (sentTriangleFormat == TRIANGLE_EDGES) {
+        for (size_t i = first; i < first + count; i++)
+            triangleEdges[i] = edgeRecord(triangles[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleEdgeSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(GPUTriangleEdges), count * sizeof(GPUTriangleEdges), triangleEdges.data() + first);
+    }
+}
+void Renderer::updateBVHNodes(const std::vector<BVHNode> &nodes, size_t first, size_t count) {
+    TRACE_SCOPE("updateBVHNodes");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(BVHNode), count * sizeof(BVHNode), nodes.data() + first);
+}
+
+// the samples are merged into the accumulation by the next raytrace()
+void Renderer::sendCpuSamples(uint rowStart, const std::vector<vec4> &samples) {
+    if (rowStart >= height) return;
+    glBindTexture(GL_TEXTURE_2D, cpuSampleTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rowStart, width, height - rowStart, GL_RGBA, GL_FLOAT, samples.data());
+    cpuSamplesReady = true;
+    cpuBatchRowStart = rowStart;
+}
+
+// compiled-in scene features for raytrace.frag, a new set compiles (or loads) another variant
+std::string Renderer::shaderDefines() const {
+    uint features = sphereFeatures | modelFeatures;
+    std::string defines;
+    defines += "#define SCENE_HAS_SPHERES " + std::to_string(sphereBuffer.count() > 0) + "\n";
+    defines += "#define SCENE_HAS_MODELS " + std::to_string(modelBuffer.count() > 0) + "\n";
+    defines += "#define SCENE_HAS_METAL " + std::to_string((features & FEATURE_METAL) != 0) + "\n";
+    defines += "#define SCENE_HAS_TRANSMISSION " + std::to_string((features & FEATURE_TRANSMISSION) != 0) + "\n";
+    defines += "#define TRIANGLE_FORMAT " + std::to_string(sentTriangleFormat) + "\n";
+    defines += "#define MAX_BOUNCES_REFLECTION " + std::to_string(maxBounces_reflection) + "\n";
+    defines += "#define MAX_BOUNCES_TRANSMISSION " + std::to_string(maxBounces_transmission) + "\n";
+    return defines;
+}
+
+// with parallel shader compilation this returns at once and the build overlaps whatever comes
+// before the variant is first used
+void Renderer::prepareShader() {
+    if (!shaderDirty && shaderBounces_reflection == maxBounces_reflection && shaderBounces_transmission == maxBounces_transmission) return;
+    shaderDirty = false;
+    shaderBounces_reflection = maxBounces_reflection;
+    shaderBounces_transmission = maxBounces_transmission;
+    std::string defines = shaderDefines();
+    auto variant = shaderVariants.find(defines);
+    if (variant == shaderVariants.end()) {
+        TRACE_SCOPE("compile shader variant");
+        variant = shaderVariants.try_emplace(defines, RESOURCES_PATH "/default.vert", RESOURCES_PATH "/raytrace.frag", defines).first;
+    }
+    pendingShader = &variant->second == shader ? nullptr : &variant->second;
+}
+
+bool Renderer::useCurrentShader(bool wait) {
+    prepareShader();
+    // without a variant yet there is nothing else to draw with
+    if (!pendingShader || !(wait || !shader || pendingShader->isReady())) return false;
+    bool replaced = shader != nullptr;
+    shader = pendingShader;
+    pendingShader = nullptr;
+    return replaced;
+}
+
+void Renderer::raytrace(const Camera &camera, uint renderedFrames) {
+    uint readIdx = writeIdx;
+    writeIdx = (writeIdx + 1) % 2;
+
+    // ---------- Pass 1: Raytrace + Accumulate to Texture ----------
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTextures[writeIdx], 0);
+    glViewport(0, 0, width, height);
+
+    useCurrentShader(waitForShader);
+    shader->use();
+    if (materialsChanged) {
+        materialBuffer.setRecords(materials.data(), materials.size());
+        materialsChanged = false;
+    }
+    sphereBuffer.bindForFrame();
+    modelBuffer.bindForFrame();
+    materialBuffer.bindForFrame();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triangleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvhSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, triangleEdgeSSBO);
+    FrameConstants constants = {
+        camera.position, camera.focalLength,
+        camera.forward, (uint)sphereBuffer.count(),
+        camera.up, (uint)modelBuffer.count(),
+        camera.right, renderedFrames,
+        camera.resolution, tileOffset,
+        maxBounces_reflection, maxBounces_transmission, samplesPerPixel, frameOffset,
+        cpuRowStart, cpuBatchRowStart, cpuSamplesReady, debugMode,
+        debugHeatmapMax, {0.0f, 0.0f, 0.0f}
+    };
+    cpuSamplesReady = false;
+    frameBuffer.setRecords(&constants, 1);
+    frameBuffer.bindForFrame();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, rayStatsSSBO);
+    glBindImageTexture(0, rayStatsImage, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, cpuSampleTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, accumTextures[readIdx]);
+
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    sphereBuffer.fenceFrame();
+    modelBuffer.fenceFrame();
+    materialBuffer.fenceFrame();
+    frameBuffer.fenceFrame();
+}
+
+void Renderer::display(int viewportWidth, int viewportHeight) {
+    // ---------- Pass 2: Display to Screen ----------
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, viewportWidth, viewportHeight);
+    displayShader.use();
+
+    displayShader.setInt("uTexture", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, accumTextures[writeIdx]);
+
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+// Collects the debug view counters of every frame since the previous call. The first call snapshots
+// them behind a fence and returns false; a later call returns true with the totals once the GPU
+// has caught up, without ever blocking.
+bool Renderer::readRayStats(RayStats &stats) {
+    if (!rayStatsFence) {
+        glBindBuffer(GL_COPY_READ_BUFFER, rayStatsSSBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, rayStatsReadback);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GPURayStats));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayStatsSSBO);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        rayStatsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return false;
+    }
+    GLenum status = glClientWaitSync(rayStatsFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+    glDeleteSync(rayStatsFence);
+    rayStatsFence = nullptr;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, rayStatsReadback);
+    GPURayStats words;
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(GPURayStats), &words);
+    uint64_t* totals[4] = {&stats.rays, &stats.nodeVisits, &stats.triangleTests, &stats.bounces};
+    for (int i = 0; i < 4; i++)
+        *totals[i] = (uint64_t)words.totals[2 * i + 1] << 32 | words.totals[2 * i];
+    stats.maxTriangleTests = words.maxTriangleTests;
+    return true;
+}
+
+// the texture the last raytrace() accumulated into
+GLuint Renderer::accumTexture() const {
+    return accumTextures[writeIdx];
+}
+
+void Renderer::setAccumulation(const std::vector<float> &pixels) {
+    glBindTexture(GL_TEXTURE_2D, accumTextures[writeIdx]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, pixels.data());
+}
+
+size_t Renderer::gpuMemoryBytes() const {
+    size_t textureBytes = 4 * (size_t)width * height * 4 * sizeof(float);
+    return sphereBuffer.bytes() + triangleBytes + triangleEdgeBytes + modelBuffer.bytes() + materialBuffer.bytes() + bvhBytes + textureBytes;
+}
+size_t Renderer::bytesPerTriangle() const {
+    return sizeof(Triangle) + (sentTriangleFormat == TRIANGLE_EDGES ? sizeof(GPUTriangleEdges) : 0);
+}
@@ -0,0 +1,203 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "model.h"
+#include "objParser.h"
+#include "persistentBuffer.h"
+#include "shader.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// the FrameConstants uniform block of raytrace.frag in std140 layout, each vec3 is followed by a
+// scalar so nothing needs padding
+struct FrameConstants {
+    vec3 cameraPosition;
+    float focalLength;
+    vec3 cameraForward;
+    uint sphereCount;
+    vec3 cameraUp;
+    uint modelCount;
+    vec3 cameraRight;
+    uint renderedFrames;
+    uvec2 resolution;
+    uvec2 tileOffset;
+    int maxBounces_reflection;
+    int maxBounces_transmission;
+    int samplesPerPixel;
+    uint frameOffset;
+    uint cpuRowStart;
+    uint cpuBatchRowStart;
+    uint cpuSamplesReady;
+    int debugMode;
+    float debugHeatmapMax;
+    float padding[3];
+};
+static_assert(sizeof(FrameConstants) == 128, "FrameConstants must match the std140 block");
+
+// What raytrace.frag reads for spheres and models: geometry and a materialIndex into the table of
+// GPUMaterials. Traversal only touches these, the material is fetched once for the closest hit.
+struct GPUMaterial {
+    vec4 color_roughness;
+    vec4 emissionColor_emissionStrength;
+    vec4 transmission_ior_metalness_tbd;
+};
+struct GPUSphere {
+    vec4 pos_radius;
+    uint materialIndex;
+    uint padding[3];
+};
+// positions are reconstructed from the world space ray, so only world to model space is needed
+struct GPUModel {
+    uint triangleIndex;
+    uint triangleCount;
+    uint nodeIndex;
+    uint materialIndex;
+    vec4 boundMin;
+    vec4 boundMax;
+    vec4 translation;
+    mat4 rotation;
+};
+
+// How raytrace.frag intersects triangles, compiled in as TRIANGLE_FORMAT. The vertex format derives
+// both edges and the geometric normal from the three vertices on every test. The edge format reads
+// them precomputed from a second, denser buffer of GPUTriangleEdges. The watertight one shears the
+// vertices into ray space, so rays can't slip through the edge shared by two triangles.
+enum TriangleFormat {
+    TRIANGLE_VERTICES,
+    TRIANGLE_EDGES,
+    TRIANGLE_WATERTIGHT
+};
+// what the edge format tests against, the normal is cross(edgeAB, edgeAC) and not normalized
+struct GPUTriangleEdges {
+    vec4 posA_normalX;
+    vec4 edgeAB_normalY;
+    vec4 edgeAC_normalZ;
+};
+
+// totals from the debug view, see raytrace.frag
+struct RayStats {
+    uint64_t rays;
+    uint64_t nodeVisits;
+    uint64_t triangleTests;
+    uint64_t bounces;
+    uint maxTriangleTests;
+};
+
+// Owns the GPU side of the path tracer: the scene SSBOs, the ping-pong accumulation textures and
+// the two passes (raytrace + accumulate, display). Needs a current GL context.
+class Renderer {
+    public:
+        Renderer(uint width_, uint height_);
+        ~Renderer();
+
+        void sendSpheres(const std::vector<Sphere> &spheres);
+        void sendTriangles(const std::vector<Triangle> &triangles);
+        void sendModels(const std::vector<SSBO_Model> &models);
+        void sendBVHNodes(const std::vector<BVHNode> &nodes);
+        // upload only the records from `first` on, e.g. meshes streamed in after the first frame;
+        // the buffers grow geometrically and are uploaded whole when they do
+        void appendTriangles(const std::vector<Triangle> &triangles, size_t first);
+        void appendBVHNodes(const std::vector<BVHNode> &nodes, size_t first);
+        // rewrite the records [first, first + count) in place, e.g. after deforming one mesh
+        void updateTriangles(const std::vector<Triangle> &triangles, size_t first, size_t count);
+        void updateBVHNodes(const std::vector<BVHNode> &nodes, size_t first, size_t count);
+        // rewrite a single record, e.g. after moving one object
+        void updateSphere(uint index, const Sphere &sphere);
+        void updateModel(uint index, const SSBO_Model &model);
+        void sendCpuSamples(uint rowStart, const std::vector<vec4> &samples);
+
+        // starts compiling (or loading) the variant for the current scene if it is new; does nothing
+        // unless the scene features, the triangle format or the bounce counts changed since
+        void prepareShader();
+        // makes the prepared variant the one raytrace() draws with, true if it replaced another. With
+        // wait == false a variant that is still compiling is left for a later call and the previous
+        // one stays in use, so the caller never stalls on a compile mid-session.
+        bool useCurrentShader(bool wait);
+        // traces samplesPerPixel samples per pixel and accumulates them; renderedFrames == 0 restarts the accumulation
+        void raytrace(const Camera &camera, uint renderedFrames);
+        void display(int viewportWidth, int viewportHeight);
+
+        bool readRayStats(RayStats &stats);
+
+        GLuint accumTexture() const;
+        // replaces the accumulation the next raytrace() continues from, RGBA32F as read back from accumTexture()
+        void setAccumulation(const std::vector<float> &pixels);
+        size_t gpuMemoryBytes() const;
+        // GPU memory per triangle in the current triangleFormat
+        size_t bytesPerTriangle() const;
+
+        uint width, height;
+        int maxBounces_reflection;
+        int maxBounces_transmission;
+        int samplesPerPixel;
+        // added to renderedFrames for seeding only, so batches rendered elsewhere draw different samples
+        uint frameOffset;
+        // where the accumulation textures sit in the camera's image when they only hold one tile of it
+        uvec2 tileOffset;
+
+        // hybrid rendering, see raytrace.frag
+        uint cpuRowStart;
+
+        // takes effect with the next sendTriangles
+        TriangleFormat triangleFormat;
+        // false: raytrace() keeps drawing with the previous variant while a new one compiles, for a
+        // caller that restarts its accumulation when useCurrentShader reports the switch
+        bool waitForShader;
+
+        // 0 = off, 1 = node visits, 2 = triangle tests, 3 = bounces, 4 = ambient occlusion
+        int debugMode;
+        float debugHeatmapMax;
+
+        // the raytrace.frag variant raytrace() draws with, see shaderDefines and useCurrentShader
+        Shader* shader;
+        Shader displayShader;
+
+    private:
+        GLuint VAO, VBO, EBO;
+        GLuint fbo;
+        GLuint accumTextures[2];
+        GLuint cpuSampleTexture;
+        PersistentBuffer sphereBuffer, modelBuffer, materialBuffer;
+        // FrameConstants, rewritten once per raytrace()
+        PersistentBuffer frameBuffer;
+        GLuint triangleSSBO, bvhSSBO, triangleEdgeSSBO;
+        GLuint rayStatsSSBO, rayStatsReadback, rayStatsImage;
+        GLsync rayStatsFence;
+        // allocated sizes, what is in use can be less after an append
+        size_t triangleBytes, bvhBytes, triangleEdgeBytes;
+        // the format the uploaded triangles were prepared for, with the edge records kept for appends
+        TriangleFormat sentTriangleFormat;
+        std::vector<GPUTriangleEdges> triangleEdges;
+        uint writeIdx;
+        bool cpuSamplesReady;
+        uint cpuBatchRowStart;
+
+        GPUSphere gpuSphere(const Sphere &sphere);
+        GPUModel gpuModel(const SSBO_Model &model);
+        // index of the material in materialBuffer, appended the first time it is seen
+        uint materialIndex(const vec4 &color_roughness, const vec4 &emissionColor_emissionStrength, const vec4 &transmission_ior_metalness_tbd);
+        std::vector<GPUMaterial> materials;
+        std::unordered_map<std::string, uint> materialIndices;
+        bool materialsChanged;
+
+        std::string shaderDefines() const;
+        std::map<std::string, Shader> shaderVariants;
+        // materials in use, only ever grow through updateSphere and updateModel
+        uint sphereFeatures, modelFeatures;
+        // set where the defines can change; the bounce counts are public and compared instead
+        bool shaderDirty;
+        int shaderBounces_reflection, shaderBounces_transmission;
+        // prepared but not drawn with yet
+        Shader* pendingShader;
+};
+
+#endif
@@ -0,0 +1,366 @@
+#include "scene.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+
+#include "glm/ext/matrix_transform.hpp"
+#include "trace.h"
+
+
+// walks the file one line at a time without copying tokens out of the buffer
+struct SceneParser {
+    const char* cursor;
+    const char* lineEnd;
+    const char* end;
+    int lineNumber = 0;
+    bool failed = false;
+    uint errorCount = 0;
+
+    bool nextLine() {
+        while (cursor < end) {
+            const char* lineStart = cursor;
+            lineEnd = lineStart;
+            while (lineEnd < end && *lineEnd != '\n') lineEnd++;
+            cursor = lineStart;
+            lineNumber++;
+            failed = false;
+            skipSpaces();
+            if (cursor < lineEnd && *cursor != '#') return true;
+            cursor = lineEnd + 1;
+        }
+        return false;
+    }
+    void finishLine() {
+        cursor = lineEnd + 1;
+    }
+    void skipSpaces() {
+        while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+    }
+    bool atLineEnd() {
+        skipSpaces();
+        return cursor >= lineEnd || *cursor == '#';
+    }
+    std::string_view word() {
+        skipSpaces();
+        const char* start = cursor;
+        while (cursor < lineEnd && *cursor != ' ' && *cursor != '\t' && *cursor != '\r') cursor++;
+        if (start == cursor) error("expected a word");
+        return std::string_view(start, cursor - start);
+    }
+    float number() {
+        skipSpaces();
+        char* next = nullptr;
+        float value = cursor < lineEnd ? std::strtof(cursor, &next) : 0.0f;
+        if (cursor >= lineEnd || next == cursor) {
+            error("expected a number");
+            return 0.0f;
+        }
+        cursor = next;
+        return value;
+    }
+    vec3 vector() {
+        float x = number();
+        float y = number();
+        float z = number();
+        return vec3(x, y, z);
+    }
+    void error(const char* message) {
+        if (!failed) {
+            std::cout << "ERROR::SCENE::LINE_" << lineNumber << ": " << message << std::endl;
+            errorCount++;
+        }
+        failed = true;
+    }
+};
+
+mat3 eulerRotation(vec3 degrees) {
+    mat4 rotation = mat4(1.0);
+    rotation = rotate(rotation, radians(degrees.z), vec3(0, 0, 1));
+    rotation = rotate(rotation, radians(degrees.y), vec3(0, 1, 0));
+    rotation = rotate(rotation, radians(degrees.x), vec3(1, 0, 0));
+    return mat3(rotation);
+}
+
+// a model line, its mesh is only read once the model is built
+struct SceneModel {
+    std::string filePath;
+    uint first;
+    // WHOLE_MESH until the file has been parsed
+    uint count;
+    int lineNumber;
+    Material material;
+    Transform transform;
+};
+static const uint WHOLE_MESH = UINT_MAX;
+
+// everything but the meshes goes straight into `scene`
+static bool parseScene(const std::string &filePath, Scene &scene, std::vector<SceneModel> &sceneModels) {
+    TRACE_SCOPE("parseScene");
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        std::cout << "ERROR::SCENE::FILE_NOT_SUCCESSFULLY_OPENED: " << filePath << std::endl;
+        return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string contents = stream.str();
+
+    SceneParser parser;
+    parser.cursor = contents.data();
+    parser.end = contents.data() + contents.size();
+
+    // names are views into `contents`, which outlives both maps
+    std::unordered_map<std::string_view, Material> materials;
+    std::unordered_map<std::string_view, std::string> meshPaths;
+
+    while (parser.nextLine()) {
+        std::string_view keyword = parser.word();
+        if (keyword == "camera") {
+            vec3 position = parser.vector();
+            float pitch = parser.number();
+            float yaw = parser.number();
+            if (!parser.failed) {
+                scene.cameraPosition = position;
+                scene.cameraPitch = pitch;
+                scene.cameraYaw = yaw;
+            }
+        } else if (keyword == "keyframe") {
+            CameraKeyframe keyframe;
+            keyframe.time = parser.number();
+            keyframe.position = parser.vector();
+            keyframe.pitch = parser.number();
+            keyframe.yaw = parser.number();
+            if (!parser.failed && !scene.cameraPath.empty() && keyframe.time <= scene.cameraPath.back().time)
+                parser.error("keyframes must be in increasing time");
+            if (!parser.failed) scene.cameraPath.push_back(keyframe);
+        } else if (keyword == "render") {
+            float maxBounces_reflection = parser.number();
+            float maxBounces_transmission = parser.number();
+            float samplesPerPixel = parser.number();
+            // the bounce counts become shader defines, the sample count a divisor
+            if (!parser.failed && (maxBounces_reflection < 0.0f || maxBounces_transmission < 0.0f || maxBounces_reflection > 1000.0f || maxBounces_transmission > 1000.0f))
+                parser.error("bounce counts must be between 0 and 1000");
+            if (!parser.failed && (samplesPerPixel < 1.0f || samplesPerPixel > 1000.0f))
+                parser.error("samples per pixel must be between 1 and 1000");
+            if (!parser.failed) {
+                scene.maxBounces_reflection = maxBounces_reflection;
+                scene.maxBounces_transmission = maxBounces_transmission;
+                scene.samplesPerPixel = samplesPerPixel;
+            }
+        } else if (keyword == "material") {
+            std::string_view name = parser.word();
+            Material material;
+            material.color = parser.vector();
+            material.roughness = parser.number();
+            material.emissionColor = parser.vector();
+            material.emissionStrength = parser.number();
+            material.alpha = 1.0;
+            material.transmission = parser.number();
+            material.ior = parser.number();
+            material.metalness = parser.number();
+            if (!parser.failed) materials[name] = material;
+        } else if (keyword == "mesh") {
+            std::string_view name = parser.word();
+            std::string_view path = parser.word();
+            if (!parser.failed) meshPaths[name] = path.front() == '/' ? std::string(path) : RESOURCES_PATH + std::string(path);
+        } else if (keyword == "model") {
+            auto mesh = meshPaths.find(parser.word());
+            auto material = materials.find(parser.word());
+            if (mesh == meshPaths.end()) parser.error("unknown mesh");
+            if (material == materials.end()) parser.error("unknown material");
+            if (parser.failed) {
+                parser.finishLine();
+                continue;
+            }
+            SceneModel model = {mesh->second, 0, WHOLE_MESH, parser.lineNumber, material->second, {vec3(0.0), mat3(1.0), vec3(1.0)}};
+            while (!parser.atLineEnd() && !parser.failed) {
+                std::string_view option = parser.word();
+                if (option == "range") {
+                    float first = parser.number();
+                    float count = parser.number();
+                    if (!parser.failed && (first < 0.0f || count < 0.0f || first >= (float)UINT_MAX || count >= (float)UINT_MAX))
+                        parser.error("range must be two counts of triangles");
+                    model.first = parser.failed ? 0 : (uint)first;
+                    model.count = parser.failed ? 0 : (uint)count;
+                } else if (option == "translate") {
+                    model.transform.translation = parser.vector();
+                } else if (option == "rotate") {
+                    // Transform.rotation maps world space into model space
+                    model.transform.rotation = transpose(eulerRotation(parser.vector()));
+                } else if (option == "scale") {
+                    model.transform.scale = parser.vector();
+                    // world to model space divides by it
+                    if (!parser.failed && (model.transform.scale.x <= 0.0f || model.transform.scale.y <= 0.0f || model.transform.scale.z <= 0.0f))
+                        parser.error("scale must be positive");
+                } else {
+                    parser.error("unknown model option");
+                }
+            }
+            if (!parser.failed) sceneModels.push_back(model);
+        } else if (keyword == "sphere") {
+            auto material = materials.find(parser.word());
+            if (material == materials.end()) parser.error("unknown material");
+            vec3 position = parser.vector();
+            float radius = parser.number();
+            if (!parser.failed) {
+                const Material &m = material->second;
+                scene.spheres.push_back({
+                    vec4(position, radius), vec4(m.color, m.roughness), vec4(m.emissionColor, m.emissionStrength), vec4(m.transmission, m.ior, m.metalness, 0.0)
+                });
+            }
+        } else {
+            parser.error("unknown keyword");
+        }
+        if (!parser.failed && !parser.atLineEnd()) parser.error("unexpected trailing values");
+        parser.finishLine();
+    }
+    scene.errorCount += parser.errorCount;
+    for (const SceneModel &model : sceneModels)
+        if (std::find(scene.meshFiles.begin(), scene.meshFiles.end(), model.filePath) == scene.meshFiles.end())
+            scene.meshFiles.push_back(model.filePath);
+    return true;
+}
+
+// the range of a model line once its file is parsed, false (and reported) if the model is dropped
+static bool resolveRange(uint first, uint &count, int lineNumber, uint fileTriangleCount) {
+    const char* error = nullptr;
+    if (fileTriangleCount == 0) error = "mesh has no triangles";
+    else if (count == WHOLE_MESH) count = fileTriangleCount - std::min(first, fileTriangleCount);
+    else if ((uint64_t)first + count > fileTriangleCount) error = "range is outside of the mesh";
+    if (!error && count == 0) error = "range is empty";
+    if (error) std::cout << "ERROR::SCENE::LINE_" << lineNumber << ": " << error << std::endl;
+    return !error;
+}
+
+bool loadScene(const std::string &filePath, Scene &scene) {
+    TRACE_SCOPE("loadScene");
+    std::vector<SceneModel> sceneModels;
+    if (!parseScene(filePath, scene, sceneModels)) return false;
+
+    std::vector<std::string> filePaths;
+    for (const SceneModel &model : sceneModels) filePaths.push_back(model.filePath);
+    preloadOBJs(filePaths);
+    // models are created once all their meshes are built, see loadMeshes
+    std::vector<MeshRange> modelMeshes;
+    std::vector<const SceneModel*> builtModels;
+    for (SceneModel &model : sceneModels) {
+        if (!resolveRange(model.first, model.count, model.lineNumber, loadOBJ(model.filePath).size())) {
+            scene.errorCount++;
+            continue;
+        }
+        modelMeshes.push_back({model.filePath, model.first, model.count});
+        builtModels.push_back(&model);
+    }
+
+    std::vector<uint> meshIds = loadMeshes(modelMeshes);
+    for (size_t i = 0; i < meshIds.size(); i++)
+        scene.models.push_back(makeSSBOModel(meshes[meshIds[i]], builtModels[i]->material, builtModels[i]->transform));
+    return true;
+}
+
+SceneStream::SceneStream() {
+    nextBuild = 0;
+    stopping = false;
+    published = 0;
+}
+SceneStream::~SceneStream() {
+    stopping = true;
+    wait();
+}
+
+bool SceneStream::start(const std::string &filePath, Scene &scene) {
+    TRACE_SCOPE("SceneStream::start");
+    std::vector<SceneModel> sceneModels;
+    if (!parseScene(filePath, scene, sceneModels)) return false;
+
+    // one build per distinct file and range, in the order the models first ask for them
+    std::unordered_map<std::string, File*> filesByPath;
+    std::unordered_map<std::string, uint> buildsByKey;
+    for (const SceneModel &model : sceneModels) {
+        std::string key = meshKey(model.filePath, model.first, model.count);
+        auto build = buildsByKey.find(key);
+        if (build == buildsByKey.end()) {
+            File* &file = filesByPath[model.filePath];
+            if (!file) file = &files.emplace_back(model.filePath);
+            builds.push_back({file, model.first, model.count, model.lineNumber, false, false, {}, {}});
+            build = buildsByKey.emplace(key, builds.size() - 1).first;
+        }
+        entries.push_back({build->second, model.material, model.transform});
+    }
+
+    // the main thread keeps rendering
+    uint threadCount = std::min<uint>(builds.size(), std::max(2u, std::thread::hardware_concurrency()) - 1);
+    for (uint t = 0; t < threadCount; t++)
+        workers.emplace_back(&SceneStream::work, this);
+    return true;
+}
+
+void SceneStream::work() {
+    for (uint i = nextBuild++; i < builds.size() && !stopping; i = nextBuild++) {
+        TRACE_SCOPE("stream mesh");
+        Build &build = builds[i];
+        File &file = *build.file;
+        std::call_once(file.parsed, [&file]() { file.triangles = getTrianglesFromOBJ(file.path); });
+        build.valid = resolveRange(build.first, build.count, build.lineNumber, file.triangles.size());
+        if (build.valid) {
+            build.triangles.assign(file.triangles.begin() + build.first, file.triangles.begin() + build.first + build.count);
+            buildBVH(build.triangles, 0, build.count, build.nodes);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        build.ready = true;
+    }
+}
+
+uint SceneStream::poll(Scene &scene) {
+    uint added = 0;
+    while (published < entries.size()) {
+        const Entry &entry = entries[published];
+        Build &build = builds[entry.build];
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!build.ready) break;
+        }
+        published++;
+        if (!build.valid) {
+            scene.errorCount++;
+            continue;
+        }
+        std::string key = meshKey(build.file->path, build.first, build.count);
+        uint meshId;
+        if (!findMesh(key, meshId)) {
+            meshId = addBuiltMesh(key, build.triangles, build.nodes);
+            build.triangles = {};
+            build.nodes = {};
+        }
+        scene.models.push_back(makeSSBOModel(meshes[meshId], entry.material, entry.transform));
+        added++;
+    }
+    return added;
+}
+
+bool SceneStream::finished() const {
+    return published == entries.size();
+}
+
+void SceneStream::wait() {
+    for (std::thread &worker : workers)
+        if (worker.joinable()) worker.join();
+}
+
+// linear between the surrounding keyframes, clamped to the ends of the path
+CameraKeyframe sampleCameraPath(const std::vector<CameraKeyframe> &cameraPath, float time) {
+    if (time <= cameraPath.front().time) return cameraPath.front();
+    for (size_t i = 1; i < cameraPath.size(); i++) {
+        const CameraKeyframe &a = cameraPath[i - 1];
+        const CameraKeyframe &b = cameraPath[i];
+        if (time > b.time) continue;
+        float t = (time - a.time) / (b.time - a.time);
+        return {time, mix(a.position, b.position, t), mix(a.pitch, b.pitch, t), mix(a.yaw, b.yaw, t)};
+    }
+    return cameraPath.back();
+}
@@ -0,0 +1,114 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model.h"
+#include "objParser.h"
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// A scene file is plain text, one entry per line, '#' starts a comment:
+//
+//   camera <x y z> <pitch> <yaw>
+//   keyframe <time> <x y z> <pitch> <yaw>
+//   render <maxBounces_reflection> <maxBounces_transmission> <samplesPerPixel>
+//   material <name> <r g b> <roughness> <emission r g b> <emissionStrength> <transmission> <ior> <metalness>
+//   mesh <name> <file.obj>
+//   model <mesh> <material> [range <first> <count>] [translate <x y z>] [rotate <x y z>] [scale <x y z>]
+//   sphere <material> <x y z> <radius>
+//
+// Materials and meshes must be declared before they are used. Mesh paths are relative to
+// RESOURCES_PATH, rotations are in degrees and applied in x, y, z order. Spheres and models are
+// parsed straight into the arrays that get uploaded to the GPU. Models are instances: every
+// distinct mesh and range is added to `triangles` and `bvhNodes` once, see loadMeshes. Keyframes
+// form the camera path rendered by --render-path and must be given in increasing time. Bounce
+// counts go from 0 to 1000, samplesPerPixel from 1 to 1000.
+struct CameraKeyframe {
+    float time;
+    vec3 position;
+    float pitch;
+    float yaw;
+};
+
+struct Scene {
+    std::vector<Sphere> spheres;
+    std::vector<SSBO_Model> models;
+    // the OBJ files the models use
+    std::vector<std::string> meshFiles;
+
+    vec3 cameraPosition = vec3(0, 0, 4);
+    float cameraPitch = 0;
+    float cameraYaw = 180;
+    std::vector<CameraKeyframe> cameraPath;
+
+    int maxBounces_reflection = 10;
+    int maxBounces_transmission = 10;
+    int samplesPerPixel = 1;
+
+    // lines that were reported and skipped, the rest of the scene still loads
+    uint errorCount = 0;
+};
+
+bool loadScene(const std::string &filePath, Scene &scene);
+
+// Loads a scene while it is already being rendered. start parses the file into the scene right
+// away, except for the models: their meshes are read and their BVHs built on background threads.
+// poll appends the models finished since the last call to `triangles`, `bvhNodes`, `meshes` and
+// scene.models, in file order, so the arrays end up the same as after loadScene.
+class SceneStream {
+    public:
+        SceneStream();
+        ~SceneStream();
+
+        bool start(const std::string &filePath, Scene &scene);
+        // returns how many models were added
+        uint poll(Scene &scene);
+        // every model has been added
+        bool finished() const;
+        // blocks until every mesh is built, the next poll adds the rest
+        void wait();
+
+    private:
+        struct File {
+            File(const std::string &path_) : path(path_) {}
+            std::string path;
+            std::once_flag parsed;
+            std::vector<Triangle> triangles;
+        };
+        // a distinct mesh file and range, shared by every model using it
+        struct Build {
+            File* file;
+            uint first, count;
+            int lineNumber;
+            bool ready;
+            bool valid;
+            std::vector<Triangle> triangles;
+            std::vector<BVHNode> nodes;
+        };
+        struct Entry {
+            uint build;
+            Material material;
+            Transform transform;
+        };
+
+        void work();
+
+        std::deque<File> files;
+        std::deque<Build> builds;
+        std::vector<Entry> entries;
+        std::vector<std::thread> workers;
+        std::atomic<uint> nextBuild;
+        std::atomic<bool> stopping;
+        // guards Build::ready, everything else in a Build is only touched by one side at a time
+        std::mutex mutex;
+        size_t published;
+};
+CameraKeyframe sampleCameraPath(const std::vector<CameraKeyframe> &cameraPath, float time);
+
+#endif
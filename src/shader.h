@@ -3,20 +3,36 @@
 
 #include <glad/glad.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 #include <bits/locale_facets_nonio.h>
 
+#include "trace.h"
+
+// GL_KHR_parallel_shader_compile, not part of the generated loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // set once the driver compiles on its own threads, see main.cpp; the constructor then returns
+    // right after glLinkProgram and errors are only checked by the first use()
+    static inline bool parallelCompile = false;
+    // constructor generates the shader on the fly, `defines` is inserted after the #version line
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = "")
     {
+        TRACE_SCOPE("Shader compile");
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -45,94 +61,216 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        if (!defines.empty())
+        {
+            injectDefines(vertexCode, defines);
+            injectDefines(fragmentCode, defines);
+        }
+        // 2. try the program binary a previous run linked from the same sources on the same driver
+        std::string cachePath = binaryCachePath(vertexCode, fragmentCode);
+        if (loadBinary(cachePath))
+            return;
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 3. compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
         // shader Program
         ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        pendingVertex = vertex;
+        pendingFragment = fragment;
+        pendingCachePath = cachePath;
+        if (!parallelCompile)
+            finishCompile();
+    }
+    // uniform locations are looked up by name once per program, the driver's lookup is a string search
+    GLint location(const std::string &name) const
+    {
+        auto cached = uniformLocations.find(name);
+        if (cached != uniformLocations.end())
+            return cached->second;
+        return uniformLocations[name] = glGetUniformLocation(ID, name.c_str());
+    }
+    // false while the driver is still compiling in the background, use() would wait for it
+    bool isReady() const
+    {
+        if (!pendingVertex)
+            return true;
+        int done;
+        glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+        return done;
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
+        if (pendingVertex)
+            finishCompile();
         glUseProgram(ID); 
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value0) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value0);
+        glUniform1i(location(name), (int)value0);
     }
     void setBool(const std::string &name, bool value0, bool value1) const {
-        glUniform2i(glGetUniformLocation(ID, name.c_str()), (int)value0, (int)value1);
+        glUniform2i(location(name), (int)value0, (int)value1);
     }
     void setBool(const std::string &name, bool value0, bool value1, bool value2) const {
-        glUniform3i(glGetUniformLocation(ID, name.c_str()), (int)value0, (int)value1, (int)value2);
+        glUniform3i(location(name), (int)value0, (int)value1, (int)value2);
     }
     void setBool(const std::string &name, bool value0, bool value1, bool value2, bool value3) const {
-        glUniform4i(glGetUniformLocation(ID, name.c_str()), (int)value0, (int)value1, (int)value2, (int)value3);
+        glUniform4i(location(name), (int)value0, (int)value1, (int)value2, (int)value3);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value0) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value0);
+        glUniform1i(location(name), value0);
     }
     void setInt(const std::string &name, int value0, int value1) const {
-        glUniform2i(glGetUniformLocation(ID, name.c_str()), value0, value1);
+        glUniform2i(location(name), value0, value1);
     }
     void setInt(const std::string &name, int value0, int value1, int value2) const {
-        glUniform3i(glGetUniformLocation(ID, name.c_str()), value0, value1, value2);
+        glUniform3i(location(name), value0, value1, value2);
     }
     void setInt(const std::string &name, int value0, int value1, int value2, int value3) const {
-        glUniform4i(glGetUniformLocation(ID, name.c_str()), value0, value1, value2, value3);
+        glUniform4i(location(name), value0, value1, value2, value3);
     }
     // ------------------------------------------------------------------------
     void setUint(const std::string &name, unsigned int value0) const {
-        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value0);
+        glUniform1ui(location(name), value0);
     }
     void setUint(const std::string &name, unsigned int value0, unsigned int value1) const {
-        glUniform2ui(glGetUniformLocation(ID, name.c_str()), value0, value1);
+        glUniform2ui(location(name), value0, value1);
     }
     void setUint(const std::string &name, unsigned int value0, unsigned int value1, unsigned int value2) const {
-        glUniform3ui(glGetUniformLocation(ID, name.c_str()), value0, value1, value2);
+        glUniform3ui(location(name), value0, value1, value2);
     }
     void setUint(const std::string &name, unsigned int value0, unsigned int value1, unsigned int value2, unsigned int value3) const {
-        glUniform4ui(glGetUniformLocation(ID, name.c_str()), value0, value1, value2, value3);
+        glUniform4ui(location(name), value0, value1, value2, value3);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value0) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value0);
+        glUniform1f(location(name), value0);
     }
     void setFloat(const std::string &name, float value0, float value1) const {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), value0, value1);
+        glUniform2f(location(name), value0, value1);
     }
     void setFloat(const std::string &name, float value0, float value1, float value2) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), value0, value1, value2);
+        glUniform3f(location(name), value0, value1, value2);
     }
     void setFloat(const std::string &name, float value0, float value1, float value2, float value3) const {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), value0, value1, value2, value3);
+        glUniform4f(location(name), value0, value1, value2, value3);
     }
 
 private:
+    unsigned int pendingVertex = 0, pendingFragment = 0;
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+    std::string pendingCachePath;
+
+    void finishCompile()
+    {
+        checkCompileErrors(pendingVertex, "VERTEX");
+        checkCompileErrors(pendingFragment, "FRAGMENT");
+        if (checkCompileErrors(ID, "PROGRAM"))
+            saveBinary(pendingCachePath);
+        // delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(pendingVertex);
+        glDeleteShader(pendingFragment);
+        pendingVertex = pendingFragment = 0;
+    }
+    // #line keeps the compiler's line numbers matching the file
+    static void injectDefines(std::string &code, const std::string &defines)
+    {
+        size_t version = code.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return;
+        code.insert(lineEnd + 1, defines + "#line 2\n");
+    }
+    // linked programs are cached in SHADER_CACHE_PATH under a hash of the sources and the driver,
+    // so editing a shader or updating the driver simply misses the cache
+    // ------------------------------------------------------------------------
+    static std::string binaryCachePath(const std::string &vertexCode, const std::string &fragmentCode)
+    {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        if (formatCount == 0)
+            return "";
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const std::string &text) {
+            for (unsigned char c : text) { hash ^= c; hash *= 1099511628211ull; }
+            hash ^= 0xff; hash *= 1099511628211ull;
+        };
+        add(vertexCode);
+        add(fragmentCode);
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+            add((const char*)glGetString(name));
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "%016llx.bin", (unsigned long long)hash);
+        return SHADER_CACHE_PATH + std::string(fileName);
+    }
+    bool loadBinary(const std::string &cachePath)
+    {
+        if (cachePath.empty())
+            return false;
+        std::ifstream file(cachePath, std::ios::binary);
+        if (!file)
+            return false;
+        TRACE_SCOPE("Shader binary load");
+        GLenum format;
+        std::vector<char> binary;
+        file.read((char*)&format, sizeof(format));
+        binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (!file.eof() || binary.empty())
+            return false;
+        ID = glCreateProgram();
+        glProgramBinary(ID, format, binary.data(), (GLsizei)binary.size());
+        int success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (success)
+            return true;
+        // the driver may reject binaries anyway, e.g. after an update it doesn't report in GL_VERSION
+        glDeleteProgram(ID);
+        return false;
+    }
+    void saveBinary(const std::string &cachePath)
+    {
+        if (cachePath.empty())
+            return;
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        GLenum format;
+        std::vector<char> binary(length);
+        glGetProgramBinary(ID, length, nullptr, &format, binary.data());
+        std::error_code error;
+        std::filesystem::create_directories(SHADER_CACHE_PATH, error);
+        std::string temporaryPath = cachePath + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary);
+            file.write((const char*)&format, sizeof(format));
+            file.write(binary.data(), binary.size());
+            if (!file)
+                return;
+        }
+        std::filesystem::rename(temporaryPath, cachePath, error);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    bool checkCompileErrors(unsigned int shader, std::string type)
     {
         int success;
         char infoLog[1024];
@@ -154,6 +292,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
 #endif
\ No newline at end of file
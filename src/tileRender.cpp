@@ -0,0 +1,235 @@
+#include "tileRender.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+#include "imageEncoder.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+bool readFully(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t count = read(fd, bytes, size);
+        if (count <= 0) return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t count = write(fd, bytes, size);
+        if (count <= 0) return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+namespace {
+
+struct Worker {
+    pid_t pid;
+    int fd;
+    bool ready;
+    // the tile being rendered, -1 when idle
+    int tile;
+    bool requeued;
+    std::chrono::high_resolution_clock::time_point sent;
+    // the message being received, its expected size follows from `ready` and `tile`
+    std::vector<char> message;
+    size_t received;
+};
+
+bool spawnWorker(const std::vector<std::string> &command, Worker &worker) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(sockets[1], 0);
+        dup2(sockets[1], 1);
+        close(sockets[0]);
+        close(sockets[1]);
+        std::vector<char*> argv;
+        for (const std::string &arg : command) argv.push_back((char*)arg.c_str());
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(sockets[1]);
+    worker = {pid, sockets[0], false, -1, false, {}, {}, 0};
+    return true;
+}
+
+size_t expectedSize(const Worker &worker, const std::vector<Tile> &tiles) {
+    if (!worker.ready) return sizeof(TileReady);
+    const Tile &tile = tiles[worker.tile];
+    return sizeof(Tile) + 4 * sizeof(float) * (size_t)tile.width * tile.height;
+}
+
+}
+
+int runTileCoordinator(const TileRenderSettings &settings) {
+    TRACE_SCOPE("runTileCoordinator");
+    const TileSetup &setup = settings.setup;
+    // a worker that dies mid-write must not take the coordinator with it
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Tile> tiles;
+    for (uint y = 0; y < setup.imageHeight; y += setup.tileSize)
+        for (uint x = 0; x < setup.imageWidth; x += setup.tileSize)
+            tiles.push_back({x, y, std::min(setup.tileSize, setup.imageWidth - x), std::min(setup.tileSize, setup.imageHeight - y)});
+    std::deque<int> pending;
+    for (int i = 0; i < (int)tiles.size(); i++) pending.push_back(i);
+    std::vector<bool> done(tiles.size(), false);
+    size_t doneCount = 0, reassigned = 0;
+    std::vector<float> image(4 * (size_t)setup.imageWidth * setup.imageHeight, 0.0f);
+
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    std::vector<Worker> workers;
+    for (uint i = 0; i < settings.workerCount; i++) {
+        Worker worker;
+        if (!spawnWorker(settings.workerCommand, worker)) {
+            std::cout << "ERROR::TILES::WORKER_NOT_STARTED: " << strerror(errno) << std::endl;
+            continue;
+        }
+        if (writeFully(worker.fd, &setup, sizeof(TileSetup))) workers.push_back(std::move(worker));
+        else close(worker.fd);
+    }
+    bool haveSceneHash = false;
+    uint64_t sceneHash = 0;
+
+    auto dropWorker = [&](Worker &worker) {
+        if (worker.tile >= 0 && !done[worker.tile] && !worker.requeued) pending.push_front(worker.tile);
+        close(worker.fd);
+        kill(worker.pid, SIGTERM);
+        waitpid(worker.pid, nullptr, 0);
+        worker.fd = -1;
+    };
+
+    while (doneCount < tiles.size()) {
+        auto now = std::chrono::high_resolution_clock::now();
+        for (Worker &worker : workers) {
+            if (worker.fd < 0 || !worker.ready) continue;
+            if (worker.tile < 0) {
+                while (!pending.empty() && done[pending.front()]) pending.pop_front();
+                if (pending.empty()) continue;
+                worker.tile = pending.front();
+                pending.pop_front();
+                worker.requeued = false;
+                worker.sent = now;
+                worker.message.resize(expectedSize(worker, tiles));
+                worker.received = 0;
+                if (!writeFully(worker.fd, &tiles[worker.tile], sizeof(Tile))) dropWorker(worker);
+            } else if (!worker.requeued && std::chrono::duration<double>(now - worker.sent).count() > settings.tileTimeout) {
+                // slow or stuck, let whoever is idle first render it as well
+                pending.push_front(worker.tile);
+                worker.requeued = true;
+                reassigned++;
+            }
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<Worker*> polled;
+        for (Worker &worker : workers) {
+            if (worker.fd < 0) continue;
+            fds.push_back({worker.fd, POLLIN, 0});
+            polled.push_back(&worker);
+        }
+        if (fds.empty()) {
+            std::cout << "ERROR::TILES::NO_WORKERS_LEFT: " << tiles.size() - doneCount << " tiles not rendered" << std::endl;
+            return -1;
+        }
+        if (poll(fds.data(), fds.size(), 100) <= 0) continue;
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].revents == 0) continue;
+            Worker &worker = *polled[i];
+            if (!worker.ready && worker.message.empty()) worker.message.resize(sizeof(TileReady));
+            if (worker.ready && worker.tile < 0) {
+                // nothing was asked for
+                dropWorker(worker);
+                continue;
+            }
+            ssize_t count = read(worker.fd, worker.message.data() + worker.received, worker.message.size() - worker.received);
+            if (count <= 0) {
+                std::cout << "ERROR::TILES::WORKER_LOST: pid " << worker.pid << std::endl;
+                dropWorker(worker);
+                continue;
+            }
+            worker.received += count;
+            if (worker.received < worker.message.size()) continue;
+
+            if (!worker.ready) {
+                TileReady ready;
+                std::memcpy(&ready, worker.message.data(), sizeof(TileReady));
+                if (!haveSceneHash) {
+                    sceneHash = ready.sceneHash;
+                    haveSceneHash = true;
+                }
+                if (ready.sceneHash != sceneHash) {
+                    std::cout << "ERROR::TILES::SCENE_MISMATCH: pid " << worker.pid << " loaded a different scene" << std::endl;
+                    dropWorker(worker);
+                    continue;
+                }
+                worker.ready = true;
+                continue;
+            }
+
+            const Tile &tile = tiles[worker.tile];
+            if (!done[worker.tile]) {
+                const float* pixels = (const float*)(worker.message.data() + sizeof(Tile));
+                for (uint row = 0; row < tile.height; row++)
+                    std::memcpy(&image[4 * ((size_t)(tile.y + row) * setup.imageWidth + tile.x)], &pixels[4 * (size_t)row * tile.width], 4 * sizeof(float) * tile.width);
+                done[worker.tile] = true;
+                doneCount++;
+            }
+            worker.tile = -1;
+        }
+    }
+
+    for (Worker &worker : workers)
+        if (worker.fd >= 0) dropWorker(worker);
+
+    std::cout << "Rendered " << tiles.size() << " tiles (" << reassigned << " reassigned) in: "
+              << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count() << 's' << std::endl;
+    EncodeJob job;
+    job.path = settings.outputPath;
+    job.width = setup.imageWidth;
+    job.height = setup.imageHeight;
+    job.pixels = std::move(image);
+    ImageEncoder encoder(1);
+    encoder.submit(std::move(job));
+    encoder.wait();
+    return 0;
+}
+
+#else
+
+bool readFully(int fd, void* data, size_t size) { return false; }
+bool writeFully(int fd, const void* data, size_t size) { return false; }
+
+int runTileCoordinator(const TileRenderSettings &settings) {
+    std::cout << "ERROR::TILES::NOT_SUPPORTED_ON_WINDOWS" << std::endl;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TILERENDER_H
+#define TILERENDER_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// Tile-distributed rendering. A coordinator splits the image into tiles and hands them to worker
+// processes over a byte stream: a socketpair for local workers, or the stdin/stdout of any command,
+// e.g. ssh, for remote ones. Messages are plain structs in native byte order:
+//
+//   coordinator -> worker   TileSetup once, then one Tile per request; closing the stream ends the worker
+//   worker -> coordinator   TileReady once the scene is loaded, then per request the Tile followed by
+//                           width * height RGBA floats (mean radiance, sample count), bottom row first
+//
+// Every worker seeds its samples from the pixel's position in the whole image, so a tile is the same
+// no matter which worker rendered it and the assembled image matches a single-node render.
+struct TileSetup {
+    uint imageWidth;
+    uint imageHeight;
+    uint tileSize;
+    uint samples;
+};
+
+struct TileReady {
+    uint64_t sceneHash;
+};
+
+struct Tile {
+    uint x, y;
+    uint width, height;
+};
+
+struct TileRenderSettings {
+    TileSetup setup;
+    uint workerCount = 2;
+    // a tile taking longer than this is handed to another worker as well, the first result wins
+    double tileTimeout = 30.0;
+    // argv of a worker, it must speak the protocol on its stdin and stdout
+    std::vector<std::string> workerCommand;
+    std::string outputPath;
+};
+
+bool readFully(int fd, void* data, size_t size);
+bool writeFully(int fd, const void* data, size_t size);
+
+// spawns the workers, hands out the tiles until every one has been returned and writes the image
+int runTileCoordinator(const TileRenderSettings &settings);
+
+#endif
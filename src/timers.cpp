@@ -0,0 +1,100 @@
+#include "timers.h"
+#include <algorithm>
+
+#include "trace.h"
+
+
+RollingStats::RollingStats(size_t window) {
+    values.resize(window);
+    next = 0;
+    filled = 0;
+    added = 0;
+}
+void RollingStats::add(double value) {
+    values[next] = value;
+    next = (next + 1) % values.size();
+    filled = std::min(filled + 1, values.size());
+    added++;
+}
+double RollingStats::mean() const {
+    if (filled == 0) return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < filled; i++) sum += values[i];
+    return sum / filled;
+}
+double RollingStats::min() const {
+    if (filled == 0) return 0.0;
+    return *std::min_element(values.begin(), values.begin() + filled);
+}
+double RollingStats::max() const {
+    if (filled == 0) return 0.0;
+    return *std::max_element(values.begin(), values.begin() + filled);
+}
+double RollingStats::last() const {
+    if (filled == 0) return 0.0;
+    return values[(next + values.size() - 1) % values.size()];
+}
+size_t RollingStats::count() const {
+    return filled;
+}
+uint64_t RollingStats::total() const {
+    return added;
+}
+
+
+GpuTimer::GpuTimer(const char* name_) {
+    name = name_;
+    glGenQueries(QUERY_COUNT, queries);
+    glGenQueries(QUERY_COUNT, timestampQueries);
+    for (int i = 0; i < QUERY_COUNT; i++) pending[i] = false;
+    next = 0;
+    active = false;
+
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    gpuClockOffsetUs = traceNowUs() - gpuNow / 1000;
+}
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(QUERY_COUNT, queries);
+    glDeleteQueries(QUERY_COUNT, timestampQueries);
+}
+
+void GpuTimer::begin() {
+    if (pending[next]) collect();
+    active = !pending[next];
+    if (!active) return;
+    glQueryCounter(timestampQueries[next], GL_TIMESTAMP);
+    glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+void GpuTimer::end() {
+    if (!active) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[next] = true;
+    next = (next + 1) % QUERY_COUNT;
+    active = false;
+}
+
+// reads finished queries oldest first and stops at the first one still in flight
+void GpuTimer::collect() {
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        int query = (next + i) % QUERY_COUNT;
+        if (!pending[query]) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        GLuint64 nanoseconds = 0, startNanoseconds = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanoseconds);
+        glGetQueryObjectui64v(timestampQueries[query], GL_QUERY_RESULT, &startNanoseconds);
+        stats.add(nanoseconds / 1e6);
+        traceRecord(name, "gpu", startNanoseconds / 1000 + gpuClockOffsetUs, nanoseconds / 1000, TRACE_GPU_THREAD);
+        pending[query] = false;
+    }
+}
+
+
+ScopedCpuTimer::ScopedCpuTimer(RollingStats &stats_) : stats(stats_) {
+    startTime = std::chrono::high_resolution_clock::now();
+}
+ScopedCpuTimer::~ScopedCpuTimer() {
+    stats.add(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count());
+}
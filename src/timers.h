@@ -0,0 +1,69 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "glad/glad.h"
+
+// mean/min/max over the last `window` values
+class RollingStats {
+    public:
+        RollingStats(size_t window = 120);
+
+        void add(double value);
+        double mean() const;
+        double min() const;
+        double max() const;
+        double last() const;
+        // values in the window
+        size_t count() const;
+        // values ever added, keeps counting once the window is full
+        uint64_t total() const;
+
+    private:
+        std::vector<double> values;
+        size_t next;
+        size_t filled;
+        uint64_t added;
+};
+
+// Times a GPU pass with GL_TIME_ELAPSED queries, in milliseconds. Results are only read once the
+// driver reports them available, a couple of frames later, so timing never stalls the pipeline;
+// if every query is still in flight the pass simply goes untimed that frame. Every measured pass is
+// also added to the trace timeline under `name`.
+class GpuTimer {
+    public:
+        GpuTimer(const char* name_);
+        ~GpuTimer();
+
+        void begin();
+        void end();
+        void collect();
+
+        RollingStats stats;
+
+    private:
+        static const int QUERY_COUNT = 4;
+        const char* name;
+        GLuint queries[QUERY_COUNT];
+        GLuint timestampQueries[QUERY_COUNT];
+        bool pending[QUERY_COUNT];
+        int next;
+        bool active;
+        // trace clock minus GPU clock
+        int64_t gpuClockOffsetUs;
+};
+
+// Adds the lifetime of the scope to `stats`, in milliseconds.
+class ScopedCpuTimer {
+    public:
+        ScopedCpuTimer(RollingStats &stats_);
+        ~ScopedCpuTimer();
+
+    private:
+        RollingStats &stats;
+        std::chrono::high_resolution_clock::time_point startTime;
+};
+
+#endif
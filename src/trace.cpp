@@ -0,0 +1,68 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+
+static const size_t TRACE_CAPACITY = 1 << 16;
+// recording only holds the lock for one slot, writing copies the ring out under it
+static std::mutex traceMutex;
+static std::vector<TraceEvent> traceEvents(TRACE_CAPACITY);
+static uint64_t traceEventCount = 0;
+static std::atomic<uint32_t> traceThreadCount(0);
+static const auto traceStartTime = std::chrono::steady_clock::now();
+
+int64_t traceNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traceStartTime).count();
+}
+
+// small sequential ids read better in the viewer than hashed std::thread::ids
+uint32_t traceThreadId() {
+    thread_local uint32_t threadId = traceThreadCount++;
+    return threadId;
+}
+
+void traceRecord(const char* name, const char* category, int64_t startUs, int64_t durationUs, uint32_t threadId) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceEvents[traceEventCount++ % TRACE_CAPACITY] = {name, category, startUs, durationUs, threadId};
+}
+
+// writes the events in the ring buffer when it is called, threads may keep recording meanwhile
+bool traceWrite(const std::string &path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "ERROR::TRACE::FILE_NOT_SUCCESSFULLY_OPENED: " << path << std::endl;
+        return false;
+    }
+    std::vector<TraceEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        uint64_t first = traceEventCount > TRACE_CAPACITY ? traceEventCount - TRACE_CAPACITY : 0;
+        for (uint64_t i = first; i < traceEventCount; i++)
+            events.push_back(traceEvents[i % TRACE_CAPACITY]);
+    }
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}},\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << TRACE_GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+    for (const TraceEvent &event : events) {
+        file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1"
+             << ",\"tid\":" << event.threadId << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+    }
+    file << "\n]}\n";
+    std::cout << "Wrote " << events.size() << " trace events to " << path << std::endl;
+    return true;
+}
+
+
+TraceScope::TraceScope(const char* name_, const char* category_) {
+    name = name_;
+    category = category_;
+    startUs = traceNowUs();
+}
+TraceScope::~TraceScope() {
+    traceRecord(name, category, startUs, traceNowUs() - startUs, traceThreadId());
+}
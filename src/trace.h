@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline of CPU scopes and GPU passes kept in a fixed-size ring buffer (the oldest events are
+// overwritten) and written out as Chrome trace_event JSON, viewable in chrome://tracing or Perfetto.
+// Event names must be string literals, only the pointer is stored.
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    int64_t startUs;
+    int64_t durationUs;
+    uint32_t threadId;
+};
+
+// pseudo thread the GPU passes are drawn on
+const uint32_t TRACE_GPU_THREAD = 0xFFFF;
+
+int64_t traceNowUs();
+uint32_t traceThreadId();
+void traceRecord(const char* name, const char* category, int64_t startUs, int64_t durationUs, uint32_t threadId);
+bool traceWrite(const std::string &path);
+
+class TraceScope {
+    public:
+        TraceScope(const char* name_, const char* category_ = "cpu");
+        ~TraceScope();
+
+    private:
+        const char* name;
+        const char* category;
+        int64_t startUs;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
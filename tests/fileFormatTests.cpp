@@ -0,0 +1,189 @@
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "checkpoint.h"
+#include "imageEncoder.h"
+
+// Round trips of the files the renderer writes: QOI screenshots through a decoder written from
+// the spec, .rtsb batches and .ckpt checkpoints through their readers. Run with ctest.
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+    if (condition) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+static std::vector<unsigned char> readFile(const std::string &path) {
+    std::vector<unsigned char> bytes;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return bytes;
+    unsigned char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + count);
+    fclose(file);
+    return bytes;
+}
+
+// straight from qoiformat.org/qoi-specification.pdf, RGBA top row first
+static bool decodeQOI(const std::vector<unsigned char> &bytes, uint &width, uint &height, std::vector<unsigned char> &rgba) {
+    if (bytes.size() < 14 + 8 || std::string(bytes.begin(), bytes.begin() + 4) != "qoif") return false;
+    auto readUint = [&](size_t at) { return (uint)bytes[at] << 24 | (uint)bytes[at + 1] << 16 | (uint)bytes[at + 2] << 8 | (uint)bytes[at + 3]; };
+    width = readUint(4);
+    height = readUint(8);
+    rgba.clear();
+    unsigned char index[64][4] = {};
+    unsigned char pixel[4] = {0, 0, 0, 255};
+    size_t at = 14, end = bytes.size() - 8;
+    while (rgba.size() < 4 * (size_t)width * height) {
+        if (at >= end) return false;
+        unsigned char op = bytes[at++];
+        int run = 1;
+        if (op == 0xfe) {
+            pixel[0] = bytes[at++];
+            pixel[1] = bytes[at++];
+            pixel[2] = bytes[at++];
+        } else if (op == 0xff) {
+            for (int c = 0; c < 4; c++) pixel[c] = bytes[at++];
+        } else if ((op & 0xc0) == 0x00) {
+            std::copy(index[op], index[op] + 4, pixel);
+        } else if ((op & 0xc0) == 0x40) {
+            pixel[0] += ((op >> 4) & 3) - 2;
+            pixel[1] += ((op >> 2) & 3) - 2;
+            pixel[2] += (op & 3) - 2;
+        } else if ((op & 0xc0) == 0x80) {
+            int dg = (op & 0x3f) - 32;
+            unsigned char next = bytes[at++];
+            pixel[0] += dg + ((next >> 4) & 0xf) - 8;
+            pixel[1] += dg;
+            pixel[2] += dg + (next & 0xf) - 8;
+        } else {
+            run = (op & 0x3f) + 1;
+        }
+        std::copy(pixel, pixel + 4, index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64]);
+        for (int i = 0; i < run; i++) rgba.insert(rgba.end(), pixel, pixel + 4);
+    }
+    return rgba.size() == 4 * (size_t)width * height;
+}
+
+// same transfer as the encoder
+static unsigned char tonemap(float value) {
+    return (unsigned char)(std::fmin(std::fmax(std::pow(value, 1.0f / 2.2f), 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+static void testQOI(const std::string &directory) {
+    // the first row is the sequence that used to decode wrong, the rest exercises every op
+    const uint width = 5, height = 40;
+    std::vector<float> pixels(4 * width * height);
+    const vec3 firstRow[width] = {vec3(1, 0, 0), vec3(0), vec3(0, 1, 0), vec3(0, 0, 1), vec3(0, 1, 0)};
+    uint rngState = 1;
+    for (uint row = 0; row < height; row++) {
+        for (uint x = 0; x < width; x++) {
+            vec3 color;
+            if (row == height - 1) color = firstRow[x];
+            else if (row < 16) color = vec3(0.5f);
+            else if (row < 24) color = vec3(0.2f + 0.01f * x, 0.3f + 0.02f * row, 0.25f);
+            else {
+                rngState = rngState * 747796405u + 2891336453u;
+                color = vec3((rngState >> 8) & 0xff, (rngState >> 16) & 0xff, rngState >> 24) / 255.0f;
+            }
+            for (int c = 0; c < 3; c++) pixels[4 * (row * width + x) + c] = color[c];
+            pixels[4 * (row * width + x) + 3] = 1.0f;
+        }
+    }
+
+    std::string path = directory + "/roundtrip.qoi";
+    {
+        ImageEncoder encoder(1);
+        encoder.submit({path, width, height, pixels, ""});
+        encoder.wait();
+    }
+    uint decodedWidth = 0, decodedHeight = 0;
+    std::vector<unsigned char> rgba;
+    bool decoded = decodeQOI(readFile(path), decodedWidth, decodedHeight, rgba);
+    check(decoded, "qoi decodes");
+    if (!decoded) return;
+    check(decodedWidth == width && decodedHeight == height, "qoi size");
+    if (rgba.size() != 4 * (size_t)width * height) return;
+    bool same = true;
+    for (uint row = 0; row < height; row++) {
+        for (uint x = 0; x < width; x++) {
+            // QOI is top row first, the accumulation bottom row first
+            const unsigned char* pixel = &rgba[4 * ((height - 1 - row) * width + x)];
+            for (int c = 0; c < 3; c++) same = same && pixel[c] == tonemap(pixels[4 * (row * width + x) + c]);
+            same = same && pixel[3] == 255;
+        }
+    }
+    check(same, "qoi pixels survive a spec decoder");
+    check(!std::filesystem::exists(path + ".tmp"), "qoi leaves no temporary file");
+}
+
+static void testBatch(const std::string &directory) {
+    const uint width = 3, height = 2;
+    std::vector<float> accumulation(4 * width * height);
+    for (size_t i = 0; i < accumulation.size(); i++) accumulation[i] = i % 4 == 3 ? 8.0f : 0.125f * i;
+    BatchInfo info = {0x0123456789abcdefull, 16, 8};
+
+    std::string path = directory + "/roundtrip.rtsb";
+    {
+        ImageEncoder encoder(1);
+        encoder.submit({path, width, height, accumulation, batchMetadata(info)});
+        encoder.wait();
+    }
+    BatchInfo readInfo = {};
+    uint readWidth = 0, readHeight = 0;
+    std::vector<float> sums;
+    bool read = readBatch(path, readInfo, readWidth, readHeight, sums);
+    check(read, "batch reads");
+    if (!read) return;
+    check(readWidth == width && readHeight == height, "batch size");
+    check(readInfo.sceneHash == info.sceneHash && readInfo.firstFrame == info.firstFrame && readInfo.frameCount == info.frameCount, "batch info");
+    bool same = sums.size() == accumulation.size();
+    for (size_t i = 0; same && i < sums.size(); i++)
+        same = sums[i] == (i % 4 == 3 ? accumulation[i] : accumulation[i] * accumulation[i - i % 4 + 3]);
+    check(same, "batch holds the radiance sums");
+    check(!std::filesystem::exists(path + ".tmp"), "batch leaves no temporary file");
+}
+
+static void testCheckpoint(const std::string &directory) {
+    const uint width = 4, height = 3;
+    std::vector<float> pixels(4 * width * height);
+    for (size_t i = 0; i < pixels.size(); i++) pixels[i] = 0.5f * i;
+    CheckpointInfo info = {42, 100, 7, vec3(1, 2, 3), -10.0f, 180.0f};
+
+    std::string path = directory + "/roundtrip.ckpt";
+    {
+        ImageEncoder encoder(1);
+        encoder.submit({path, width, height, pixels, checkpointMetadata(info)});
+        encoder.wait();
+    }
+    CheckpointInfo readInfo = {};
+    uint readWidth = 0, readHeight = 0;
+    std::vector<float> readPixels;
+    bool read = readCheckpoint(path, readInfo, readWidth, readHeight, readPixels);
+    check(read, "checkpoint reads");
+    if (!read) return;
+    check(readWidth == width && readHeight == height, "checkpoint size");
+    check(readInfo.sceneHash == info.sceneHash && readInfo.frameIndex == info.frameIndex && readInfo.cpuFrameIndex == info.cpuFrameIndex
+          && readInfo.cameraPosition == info.cameraPosition && readInfo.cameraPitch == info.cameraPitch && readInfo.cameraYaw == info.cameraYaw, "checkpoint info");
+    check(readPixels == pixels, "checkpoint pixels");
+    check(!std::filesystem::exists(path + ".tmp"), "checkpoint leaves no temporary file");
+}
+
+int main() {
+    std::string directory = (std::filesystem::temp_directory_path() / "raytracer_tests").string();
+    std::filesystem::create_directories(directory);
+    testQOI(directory);
+    testBatch(directory);
+    testCheckpoint(directory);
+    std::filesystem::remove_all(directory);
+    if (failures == 0) std::cout << "all file format tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "model.h"
+
+// updateMesh on the CPU side: refit bounds must contain the moved triangles, the tree is only
+// rebuilt once its SAH cost passes the rebuild threshold, and a rebuild leaves the meshes behind
+// it intact. Run with ctest.
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+    if (condition) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+// like the benchmark's animated grid; a flat one would make any wave look like a degraded tree
+static float waveHeight(float x, float z, float time) {
+    return 0.1f * sin(x * 7.0f + time) * cos(z * 5.0f);
+}
+
+// a wavy grid of 2 * resolution^2 triangles around height y, returns its mesh
+static uint addGrid(uint resolution, float y) {
+    uint firstTriangle = triangles.size();
+    auto vertex = [&](uint i, uint j) {
+        float x = i / (float)resolution, z = j / (float)resolution;
+        return vec4(x, y + waveHeight(x, z, 0.0f), z, 0.0f);
+    };
+    for (uint i = 0; i < resolution; i++) {
+        for (uint j = 0; j < resolution; j++) {
+            vec4 a = vertex(i, j), b = vertex(i + 1, j), c = vertex(i + 1, j + 1), d = vertex(i, j + 1);
+            triangles.push_back({a, c, b, vec4(0, 1, 0, 0), vec4(0, 1, 0, 0), vec4(0, 1, 0, 0)});
+            triangles.push_back({a, d, c, vec4(0, 1, 0, 0), vec4(0, 1, 0, 0), vec4(0, 1, 0, 0)});
+        }
+    }
+    return addMesh(firstTriangle, triangles.size() - firstTriangle);
+}
+
+static bool contains(const BVHNode &node, vec3 point) {
+    return all(greaterThanEqual(point, node.boundMin)) && all(lessThanEqual(point, node.boundMax));
+}
+
+// every node lies inside the mesh's node range and contains its triangles or children
+static bool treeContainsTriangles(uint meshId) {
+    const Mesh &mesh = meshes[meshId];
+    std::vector<uint> stack = {mesh.nodeIndex};
+    uint trianglesSeen = 0;
+    while (!stack.empty()) {
+        uint index = stack.back();
+        stack.pop_back();
+        if (index < mesh.nodeIndex || index >= mesh.nodeIndex + mesh.nodeCount) return false;
+        const BVHNode &node = bvhNodes[index];
+        if (node.triangleCount > 0) {
+            for (uint t = node.leftFirst; t < node.leftFirst + node.triangleCount; t++) {
+                const Triangle &triangle = triangles[t];
+                if (t < mesh.triangleIndex || t >= mesh.triangleIndex + mesh.triangleCount) return false;
+                if (!contains(node, triangle.pos_uvx_A) || !contains(node, triangle.pos_uvx_B) || !contains(node, triangle.pos_uvx_C)) return false;
+            }
+            trianglesSeen += node.triangleCount;
+            continue;
+        }
+        for (uint child = node.leftFirst; child < node.leftFirst + 2; child++) {
+            if (child >= bvhNodes.size()) return false;
+            if (!contains(node, bvhNodes[child].boundMin) || !contains(node, bvhNodes[child].boundMax)) return false;
+            stack.push_back(child);
+        }
+    }
+    return trianglesSeen == mesh.triangleCount && mesh.boundMin == bvhNodes[mesh.nodeIndex].boundMin && mesh.boundMax == bvhNodes[mesh.nodeIndex].boundMax;
+}
+
+// what updateMesh is about to decide, from a refit of a copy of the nodes
+static bool needsRebuild(uint meshId) {
+    const Mesh &mesh = meshes[meshId];
+    std::vector<BVHNode> nodes = bvhNodes;
+    refitBVH(triangles, nodes, mesh.nodeIndex, mesh.nodeCount);
+    return costBVH(nodes, mesh.nodeIndex) > mesh.buildCost * REBUILD_THRESHOLD;
+}
+
+static void testRefit() {
+    clearMeshes();
+    uint grid = addGrid(32, 0.0f);
+    uint other = addGrid(8, 2.0f);
+    float buildCost = meshes[grid].buildCost;
+    uint nodeCount = meshes[grid].nodeCount;
+
+    // one benchmark frame of travelling waves keeps the topology good enough
+    const Mesh &mesh = meshes[grid];
+    for (uint i = mesh.triangleIndex; i < mesh.triangleIndex + mesh.triangleCount; i++)
+        for (vec4* vertex : {&triangles[i].pos_uvx_A, &triangles[i].pos_uvx_B, &triangles[i].pos_uvx_C})
+            vertex->y = waveHeight(vertex->x, vertex->z, 0.1f);
+    check(!needsRebuild(grid), "travelling waves stay under the rebuild threshold");
+    updateMesh(grid);
+    check(meshes[grid].buildCost == buildCost && meshes[grid].nodeCount == nodeCount, "travelling waves only refit");
+    check(meshes[grid].boundMax.y >= waveHeight(0.0f, 0.0f, 0.1f), "refit bounds follow the waves");
+    check(treeContainsTriangles(grid), "refit tree contains the moved triangles");
+    check(treeContainsTriangles(other), "refit leaves the other mesh intact");
+}
+
+static void testRebuild() {
+    clearMeshes();
+    uint grid = addGrid(32, 0.0f);
+    uint other = addGrid(8, 2.0f);
+
+    // scatter the triangles across the grid, the old leaves now span the whole mesh
+    const Mesh &mesh = meshes[grid];
+    std::vector<Triangle> moved(triangles.begin() + mesh.triangleIndex, triangles.begin() + mesh.triangleIndex + mesh.triangleCount);
+    for (uint i = 0; i < mesh.triangleCount; i++) {
+        const Triangle &source = moved[(i * 7919u) % mesh.triangleCount];
+        triangles[mesh.triangleIndex + i].pos_uvx_A = source.pos_uvx_A;
+        triangles[mesh.triangleIndex + i].pos_uvx_B = source.pos_uvx_B;
+        triangles[mesh.triangleIndex + i].pos_uvx_C = source.pos_uvx_C;
+    }
+    check(needsRebuild(grid), "scattered triangles pass the rebuild threshold");
+    updateMesh(grid);
+    // a refit would have stayed above it
+    check(costBVH(bvhNodes, meshes[grid].nodeIndex) <= meshes[grid].buildCost * REBUILD_THRESHOLD, "scattered triangles rebuild the tree");
+    check(treeContainsTriangles(grid), "rebuilt tree contains the moved triangles");
+    check(treeContainsTriangles(other), "rebuild keeps the shifted mesh behind it intact");
+}
+
+int main() {
+    testRefit();
+    testRebuild();
+    clearMeshes();
+    if (failures == 0) std::cout << "all mesh update tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
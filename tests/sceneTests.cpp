@@ -0,0 +1,60 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "scene.h"
+
+// Scene files with bad lines: every one is reported and counted, the values on it never reach the
+// scene. Run with ctest.
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+    if (condition) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+static bool loadSceneText(const std::string &path, const std::string &text, Scene &scene) {
+    std::ofstream(path) << text;
+    return loadScene(path, scene);
+}
+
+static const std::string header =
+    "material white 1 1 1 1 0 0 0 0 0 1 0\n"
+    "mesh box box.obj\n";
+
+static void testValidScene(const std::string &directory) {
+    Scene scene;
+    check(loadSceneText(directory + "/valid.scene", header + "render 4 2 3\nmodel box white range 0 12 scale 1 2 1\n", scene), "valid scene loads");
+    check(scene.errorCount == 0, "valid scene has no errors");
+    check(scene.maxBounces_reflection == 4 && scene.maxBounces_transmission == 2 && scene.samplesPerPixel == 3, "render values");
+    check(scene.models.size() == 1, "valid model is added");
+    clearMeshes();
+}
+
+static void testRejectedLines(const std::string &directory) {
+    Scene scene;
+    check(loadSceneText(directory + "/rejected.scene", header +
+        "render 4 2 0\n"
+        "render -1 2 3\n"
+        "model box white range -1 5\n"
+        "model box white range 0 -5\n"
+        "model box white range 0 0\n"
+        "model box white scale 0 1 1\n", scene), "scene with bad lines still loads");
+    check(scene.errorCount == 6, "every bad line is counted");
+    check(scene.samplesPerPixel == 1 && scene.maxBounces_reflection == 10, "rejected render values are not used");
+    check(scene.models.empty(), "rejected models are not added");
+    clearMeshes();
+}
+
+int main() {
+    std::string directory = (std::filesystem::temp_directory_path() / "raytracer_scene_tests").string();
+    std::filesystem::create_directories(directory);
+    testValidScene(directory);
+    testRejectedLines(directory);
+    std::filesystem::remove_all(directory);
+    if (failures == 0) std::cout << "all scene tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}